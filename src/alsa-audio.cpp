@@ -0,0 +1,231 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "alsa-audio.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fmt/ostream.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <utility>
+
+static void check(int result, const char *what)
+{
+	if (result < 0) {
+		throw std::runtime_error(fmt::format("Could not set ALSA {}: {}", what, snd_strerror(result)));
+	}
+}
+
+static uint8_t *get_address(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset)
+{
+	return static_cast<uint8_t *>(areas[0].addr) + (areas[0].first + offset * areas[0].step) / 8;
+}
+
+AlsaAudio::~AlsaAudio()
+{
+	stop();
+
+	if (pcm) {
+		snd_pcm_close(pcm);
+	}
+}
+
+void AlsaAudio::open(const std::string &device, unsigned int rate, snd_pcm_uframes_t period_size, unsigned int periods)
+{
+	int result = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+
+	if (result < 0) {
+		pcm = nullptr;
+		throw std::runtime_error(fmt::format("Could not open ALSA device {}: {}", device, snd_strerror(result)));
+	}
+
+	snd_pcm_hw_params_t *hw_params;
+	snd_pcm_hw_params_alloca(&hw_params);
+	check(snd_pcm_hw_params_any(pcm, hw_params), "hardware parameters");
+	check(snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED), "mmap access");
+
+	static const std::pair<snd_pcm_format_t, SampleFormat> formats[] = {
+		{SND_PCM_FORMAT_FLOAT, SampleFormat::F32},
+		{SND_PCM_FORMAT_S32, SampleFormat::S32},
+		{SND_PCM_FORMAT_S24_3LE, SampleFormat::S24_3LE},
+		{SND_PCM_FORMAT_S16, SampleFormat::S16},
+	};
+
+	result = -EINVAL;
+
+	for (auto [alsa_format, sample_format] : formats) {
+		if (snd_pcm_hw_params_test_format(pcm, hw_params, alsa_format) == 0) {
+			result = snd_pcm_hw_params_set_format(pcm, hw_params, alsa_format);
+			format = sample_format;
+			break;
+		}
+	}
+
+	check(result, "sample format");
+
+	channels = 2;
+	check(snd_pcm_hw_params_set_channels_near(pcm, hw_params, &channels), "channels");
+	check(snd_pcm_hw_params_set_rate_near(pcm, hw_params, &rate, nullptr), "sample rate");
+	check(snd_pcm_hw_params_set_period_size_near(pcm, hw_params, &period_size, nullptr), "period size");
+
+	// A chunk is only written once it fits as a whole, so the buffer must hold a period plus almost a chunk, or every period underruns.
+	periods = std::max<unsigned int>(periods, (period_size + chunk_size - 1 + period_size - 1) / period_size);
+	check(snd_pcm_hw_params_set_periods_near(pcm, hw_params, &periods, nullptr), "number of periods");
+	check(snd_pcm_hw_params(pcm, hw_params), "hardware parameters");
+
+	snd_pcm_hw_params_get_period_size(hw_params, &period_size, nullptr);
+	snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size);
+	this->rate = rate;
+	this->period_size = period_size;
+
+	if (buffer_size < chunk_size) {
+		throw std::runtime_error("ALSA buffer is smaller than a chunk");
+	}
+
+	if (buffer_size < period_size + chunk_size - 1) {
+		fmt::print(std::cerr, "ALSA buffer of {} frames is too small for periods of {} frames, expect xruns\n", buffer_size, period_size);
+	}
+
+	// Wake up as soon as a whole chunk fits, and only start playback explicitly once the buffer has been filled.
+	snd_pcm_uframes_t boundary;
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_sw_params_alloca(&sw_params);
+	check(snd_pcm_sw_params_current(pcm, sw_params), "software parameters");
+	check(snd_pcm_sw_params_get_boundary(sw_params, &boundary), "software parameters");
+	check(snd_pcm_sw_params_set_avail_min(pcm, sw_params, chunk_size), "minimum available frames");
+	check(snd_pcm_sw_params_set_start_threshold(pcm, sw_params, boundary), "start threshold");
+	check(snd_pcm_sw_params(pcm, sw_params), "software parameters");
+
+	staging.resize(chunk_size * channels * get_sample_size(format));
+}
+
+void AlsaAudio::start(RenderFunction render, int priority)
+{
+	this->render = render;
+	quit = false;
+	thread = std::thread(&AlsaAudio::run, this);
+
+	if (priority <= 0) {
+		return;
+	}
+
+	// Try to get real-time priority, but continue without it if we are not allowed to.
+	sched_param param{};
+	param.sched_priority = std::clamp(priority, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+
+	if (int result = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param)) {
+		fmt::print(std::cerr, "Could not set real-time priority {} for the audio thread: {}\n", param.sched_priority, strerror(result));
+	}
+}
+
+void AlsaAudio::stop()
+{
+	if (!thread.joinable()) {
+		return;
+	}
+
+	quit = true;
+	thread.join();
+	snd_pcm_drop(pcm);
+
+	if (auto count = get_xruns()) {
+		fmt::print(std::cerr, "{} ALSA xruns\n", count);
+	}
+}
+
+void AlsaAudio::run()
+{
+	const size_t frame_size = channels * get_sample_size(format);
+
+	while (!quit.load(std::memory_order_relaxed)) {
+		auto avail = snd_pcm_avail_update(pcm);
+
+		if (avail < 0) {
+			recover(avail);
+			continue;
+		}
+
+		if (snd_pcm_uframes_t(avail) < chunk_size) {
+			// After (re)starting, play once the buffer is full, otherwise wait for room, but check for quit regularly.
+			int result = snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED ? snd_pcm_start(pcm) : snd_pcm_wait(pcm, 100);
+
+			if (result < 0) {
+				recover(result);
+			}
+
+			continue;
+		}
+
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t frames = chunk_size;
+		int result = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+
+		if (result < 0) {
+			recover(result);
+			continue;
+		}
+
+		if (frames == chunk_size) {
+			render(get_address(areas, offset));
+			commit(offset, frames);
+			continue;
+		}
+
+		// The free space wraps around the end of the hardware buffer, so copy the chunk in two parts.
+		render(staging.data());
+		const uint8_t *data = staging.data();
+		snd_pcm_uframes_t remaining = chunk_size;
+
+		while (true) {
+			memcpy(get_address(areas, offset), data, frames * frame_size);
+
+			if (!commit(offset, frames)) {
+				break;
+			}
+
+			data += frames * frame_size;
+			remaining -= frames;
+
+			if (!remaining) {
+				break;
+			}
+
+			frames = remaining;
+			result = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+
+			if (result < 0) {
+				recover(result);
+				break;
+			}
+		}
+	}
+}
+
+bool AlsaAudio::commit(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	auto result = snd_pcm_mmap_commit(pcm, offset, frames);
+
+	if (result < 0 || snd_pcm_uframes_t(result) != frames) {
+		recover(result < 0 ? result : -EPIPE);
+		return false;
+	}
+
+	return true;
+}
+
+void AlsaAudio::recover(int error)
+{
+	if (error == -EPIPE || error == -ESTRPIPE) {
+		xruns.store(xruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// Restarts the stream after an underrun or suspend. The buffer is filled again before playback continues.
+	if (snd_pcm_recover(pcm, error, 1) < 0) {
+		// Probably unplugged, don't spin.
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <alsa/asoundlib.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sample-format.hpp"
+
+/**
+ * Audio output directly to an ALSA PCM device, bypassing SDL's audio layer.
+ *
+ * A real-time thread renders chunks straight into the memory-mapped hardware buffer
+ * whenever there is room for one. Since it does not wait for a callback per period,
+ * the period size does not have to match the chunk size.
+ */
+class AlsaAudio
+{
+public:
+	// Renders one chunk in the negotiated format and number of channels.
+	using RenderFunction = void (*)(uint8_t *output);
+
+	AlsaAudio() = default;
+	~AlsaAudio();
+
+	AlsaAudio(const AlsaAudio &other) = delete;
+	AlsaAudio(AlsaAudio &&other) = delete;
+	AlsaAudio &operator=(const AlsaAudio &other) = delete;
+
+	/**
+	 * Open and configure a PCM device.
+	 *
+	 * The sample rate, period size and number of periods are requests, the device may choose values close to them.
+	 * The sample format is the first of F32, S32, S24_3LE and S16 the device supports.
+	 */
+	void open(const std::string &device, unsigned int rate, snd_pcm_uframes_t period_size, unsigned int periods);
+
+	/**
+	 * Start the render thread.
+	 *
+	 * @param priority  The SCHED_FIFO priority of the render thread, or 0 to not use real-time scheduling.
+	 *                  It is clamped to the range the system supports.
+	 */
+	void start(RenderFunction render, int priority);
+	void stop();
+
+	unsigned int get_rate() const
+	{
+		return rate;
+	}
+
+	unsigned int get_channels() const
+	{
+		return channels;
+	}
+
+	SampleFormat get_format() const
+	{
+		return format;
+	}
+
+	snd_pcm_uframes_t get_period_size() const
+	{
+		return period_size;
+	}
+
+	snd_pcm_uframes_t get_buffer_size() const
+	{
+		return buffer_size;
+	}
+
+	uint64_t get_xruns() const
+	{
+		return xruns.load(std::memory_order_relaxed);
+	}
+
+private:
+	snd_pcm_t *pcm{};
+	std::thread thread;
+	std::atomic<bool> quit{};
+	std::atomic<uint64_t> xruns{};
+	RenderFunction render{};
+
+	unsigned int rate{};
+	unsigned int channels{};
+	SampleFormat format{SampleFormat::F32};
+	snd_pcm_uframes_t period_size{};
+	snd_pcm_uframes_t buffer_size{};
+
+	// Used when the free part of the hardware buffer wraps around in the middle of a chunk.
+	std::vector<uint8_t> staging;
+
+	void run();
+	bool commit(snd_pcm_uframes_t offset, snd_pcm_uframes_t frames);
+	void recover(int error);
+};
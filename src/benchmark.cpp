@@ -0,0 +1,501 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fftw3.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envelopes/exponential-adsr.hpp"
+#include "envelopes/exponential-dx7.hpp"
+#include "filters/biquad.hpp"
+#include "filters/state-variable.hpp"
+#include "oscillators/basic.hpp"
+#include "oscillators/pm.hpp"
+#include "pling.hpp"
+#include "program-manager.hpp"
+#include "utils.hpp"
+
+using duration = std::chrono::steady_clock::duration;
+
+namespace
+{
+
+struct Result {
+	std::string group;
+	std::string name;
+	unsigned int voices;
+	double ns_per_sample;
+	double realtime_factor;
+
+	// Time to render one chunk, in microseconds
+	double p50;
+	double p99;
+	double max;
+};
+
+}
+
+// Keeps the compiler from optimizing away the code being measured.
+static volatile float sink;
+
+static Result summarize(const std::string &group, const std::string &name, unsigned int voices, std::vector<duration> &times)
+{
+	duration total{};
+
+	for (auto time : times) {
+		total += time;
+	}
+
+	std::sort(times.begin(), times.end());
+
+	auto us = [](duration time) {
+		return std::chrono::duration<double, std::micro>(time).count();
+	};
+
+	double ns = std::chrono::duration<double, std::nano>(total).count() / (times.size() * chunk_size);
+
+	return {
+		group,
+		name,
+		voices,
+		ns,
+		1e9 / (ns * sample_rate),
+		us(times[times.size() / 2]),
+		us(times[times.size() * 99 / 100]),
+		us(times.back()),
+	};
+}
+
+static void print_header()
+{
+	fmt::print("{:8} {:24} {:>6} {:>10} {:>10} {:>9} {:>9} {:>9}\n", "Group", "Name", "Voices", "ns/sample", "RT factor", "p50 µs", "p99 µs", "max µs");
+}
+
+static void print_result(const Result &result)
+{
+	fmt::print("{:8} {:24} {:6} {:10.2f} {:10.1f} {:9.2f} {:9.2f} {:9.2f}\n",
+	           result.group, result.name, result.voices, result.ns_per_sample, result.realtime_factor, result.p50, result.p99, result.max);
+}
+
+static void write_json(std::ostream &out, const std::vector<Result> &results)
+{
+	fmt::print(out, "{{\n\t\"sample_rate\": {},\n\t\"chunk_size\": {},\n\t\"results\": [\n", sample_rate, chunk_size);
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		auto &result = results[i];
+		fmt::print(out, "\t\t{{\"group\": \"{}\", \"name\": \"{}\", \"voices\": {}, \"ns_per_sample\": {:.3f}, \"realtime_factor\": {:.3f}, "
+		           "\"chunk_us\": {{\"p50\": {:.3f}, \"p99\": {:.3f}, \"max\": {:.3f}}}}}{}\n",
+		           result.group, result.name, result.voices, result.ns_per_sample, result.realtime_factor,
+		           result.p50, result.p99, result.max, i + 1 < results.size() ? "," : "");
+	}
+
+	fmt::print(out, "\t]\n}}\n");
+}
+
+/**
+ * Measure the time it takes an engine to render a number of held notes.
+ *
+ * The program is rendered via the program manager, exactly like during live play.
+ */
+static Result benchmark_engine(const std::string &engine_name, unsigned int voices)
+{
+	using clock = std::chrono::steady_clock;
+	static const size_t warmup_chunks = 100;
+	static const size_t measured_chunks = 2000;
+
+	Chunk chunk;
+	std::vector<duration> times;
+	times.reserve(measured_chunks);
+
+	auto program = programs.create(engine_name);
+	programs.activate(program);
+
+	for (unsigned int i = 0; i < voices; ++i) {
+		program->note_on(48 + i, 80 + i);
+	}
+
+	for (size_t i = 0; i < warmup_chunks; ++i) {
+		programs.render(chunk);
+	}
+
+	for (size_t i = 0; i < measured_chunks; ++i) {
+		auto begin = clock::now();
+		programs.render(chunk);
+		times.push_back(clock::now() - begin);
+	}
+
+	sink = chunk.samples[0];
+
+	// Let the program go silent, so it no longer adds to the next measurement.
+	program->release_all();
+
+	for (size_t i = 0; i < 10000 && programs.render(chunk); ++i) {
+	}
+
+	return summarize("engine", engine_name, voices, times);
+}
+
+/**
+ * Measure the time it takes a DSP primitive to process a chunk.
+ *
+ * @param process  A function that fills a chunk with the output of the primitive.
+ */
+static Result benchmark_dsp(const std::string &name, const std::function<void(Chunk &)> &process)
+{
+	using clock = std::chrono::steady_clock;
+	static const size_t warmup_chunks = 100;
+	static const size_t measured_chunks = 10000;
+
+	Chunk chunk;
+	std::vector<duration> times;
+	times.reserve(measured_chunks);
+
+	for (size_t i = 0; i < warmup_chunks; ++i) {
+		process(chunk);
+	}
+
+	for (size_t i = 0; i < measured_chunks; ++i) {
+		auto begin = clock::now();
+		process(chunk);
+		times.push_back(clock::now() - begin);
+	}
+
+	sink = chunk.samples[0];
+
+	return summarize("dsp", name, 1, times);
+}
+
+static void benchmark_engines(std::vector<Result> &results)
+{
+	for (auto &engine_name : programs.get_engine_names()) {
+		for (unsigned int voices : {1, 2, 4, 8, 16, 32}) {
+			print_result(results.emplace_back(benchmark_engine(engine_name, voices)));
+		}
+	}
+}
+
+static void benchmark_dsp(std::vector<Result> &results)
+{
+	// Filters get a sawtooth wave as input, which has energy in all harmonics.
+	Chunk input;
+	Oscillator::Basic input_osc(key_to_frequency(57.01f));
+
+	for (auto &sample : input.samples) {
+		sample = input_osc.saw();
+		input_osc.update();
+	}
+
+	auto run = [&](const std::string & name, const std::function<void(Chunk &)> &process) {
+		print_result(results.emplace_back(benchmark_dsp(name, process)));
+	};
+
+	{
+		Envelope::ExponentialADSR::Parameters params;
+		params.set(0.01f, 0.2f, 0.5f, 0.3f);
+		Envelope::ExponentialADSR envelope;
+		envelope.init();
+
+		run("Exponential ADSR", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				sample = envelope.update(params);
+			}
+		});
+	}
+
+	{
+		Envelope::ExponentialDX7::Parameters params{{-48, 0, -6, -96}, {0.01f, 0.2f, 0.3f, 0.5f}};
+		Envelope::ExponentialDX7 envelope;
+		envelope.init(params);
+
+		run("Exponential DX7", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				sample = envelope.update(params);
+			}
+		});
+	}
+
+	using SVFType = Filter::StateVariable::Parameters::Type;
+
+	for (auto [name, type] : {std::pair{"SVF lowpass", SVFType::lowpass}, std::pair{"SVF lowpass24", SVFType::lowpass24}}) {
+		Filter::StateVariable::Parameters params;
+		params.set(type, 1000, 2);
+		Filter::StateVariable svf;
+
+		run(name, [&](Chunk & chunk) {
+			for (size_t i = 0; i < chunk_size; ++i) {
+				chunk.samples[i] = svf(params, input.samples[i]);
+			}
+		});
+	}
+
+	{
+		Filter::Biquad::Parameters params;
+		params.set(Filter::Biquad::Parameters::Type::lowpass, 1000, 2, 0);
+		Filter::Biquad biquad;
+
+		run("Biquad lowpass", [&](Chunk & chunk) {
+			for (size_t i = 0; i < chunk_size; ++i) {
+				chunk.samples[i] = biquad(params, input.samples[i]);
+			}
+		});
+	}
+
+	const float frequency = key_to_frequency(69.01f);
+
+	{
+		Oscillator::Basic osc(frequency);
+
+		run("Basic saw", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				sample = osc.saw();
+				osc.update();
+			}
+		});
+	}
+
+	{
+		Oscillator::Basic osc(frequency);
+
+		run("Basic saw BLEP", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				sample = osc.saw_blep();
+				osc.update();
+			}
+		});
+	}
+
+	{
+		Oscillator::PM osc;
+
+		run("PM sine", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				osc.update(frequency / sample_rate);
+				sample = osc.sine(0);
+			}
+		});
+	}
+
+	{
+		Oscillator::PM osc;
+
+		run("PM saw BLEP", [&](Chunk & chunk) {
+			for (auto &sample : chunk.samples) {
+				osc.update(frequency / sample_rate);
+				sample = osc.saw_blep(0);
+			}
+		});
+	}
+}
+
+static void benchmark_oscillators()
+{
+	using Oscillator::PM;
+	using clock = std::chrono::steady_clock;
+
+	static const size_t length = 1 << 20;
+	static const float frequency = 997;
+	std::vector<float> phases(length);
+	std::vector<float> output(length);
+
+	// Only measure the waveform calculation, the phase is fed in as phase modulation.
+	PM phase;
+
+	for (auto &value : phases) {
+		phase.update(frequency / sample_rate);
+		value = phase;
+	}
+
+	for (auto accuracy : {PM::Accuracy::LIBM, PM::Accuracy::POLYNOMIAL, PM::Accuracy::WAVETABLE}) {
+		PM osc;
+		auto begin = clock::now();
+
+		for (size_t i = 0; i < length; ++i) {
+			output[i] = osc.sine(phases[i], accuracy);
+		}
+
+		auto end = clock::now();
+
+		// Compare against a sine calculated in double precision
+		double signal{};
+		double noise{};
+
+		for (size_t i = 0; i < length; ++i) {
+			double exact = std::sin(phases[i] * 2 * M_PI);
+			signal += exact * exact;
+			noise += (output[i] - exact) * (output[i] - exact);
+		}
+
+		auto ns = std::chrono::duration<double, std::nano>(end - begin).count() / length;
+		fmt::print("{:>10}: {:6.2f} ns/sample, THD+N {:7.1f} dB\n", PM::get_accuracy_name(accuracy), ns, 10 * std::log10(noise / signal));
+	}
+}
+
+/**
+ * Measure the energy of aliased frequency components in a periodic signal.
+ *
+ * All frequency components that are not near a harmonic of the fundamental frequency,
+ * and are below the Nyquist frequency, are considered to be aliases.
+ *
+ * @return The ratio of the aliased energy to the total energy, in dB.
+ */
+static float measure_aliasing(const std::vector<float> &signal, float frequency)
+{
+	const size_t size = signal.size();
+	std::vector<float> windowed(size);
+	std::vector<fftwf_complex> spectrum(size / 2 + 1);
+
+	// Use a 4-term Blackman-Harris window, which has sidelobes below -92 dB.
+	for (size_t i = 0; i < size; ++i) {
+		float x = 2 * M_PI * i / size;
+		windowed[i] = signal[i] * (0.35875f - 0.48829f * std::cos(x) + 0.14128f * std::cos(2 * x) - 0.01168f * std::cos(3 * x));
+	}
+
+	auto plan = fftwf_plan_dft_r2c_1d(size, windowed.data(), spectrum.data(), FFTW_ESTIMATE);
+	fftwf_execute(plan);
+	fftwf_destroy_plan(plan);
+
+	// The main lobe of the window is 4 bins wide on each side
+	const float harmonic_spacing = frequency * size / sample_rate;
+	double total{};
+	double aliased{};
+
+	for (size_t i = 0; i < spectrum.size(); ++i) {
+		double power = spectrum[i][0] * spectrum[i][0] + spectrum[i][1] * spectrum[i][1];
+		float harmonic = std::round(i / harmonic_spacing);
+		total += power;
+
+		if (std::abs(i - harmonic * harmonic_spacing) > 5) {
+			aliased += power;
+		}
+	}
+
+	return 10 * std::log10(aliased / total);
+}
+
+static void benchmark_aliasing()
+{
+	using clock = std::chrono::steady_clock;
+
+	static const size_t length = 1 << 16;
+	std::vector<float> output(length);
+
+	struct Waveform {
+		const char *name;
+		std::function<float(Oscillator::PM &)> pm;
+		std::function<float(Oscillator::Basic &)> basic;
+	};
+
+	static const Waveform waveforms[] = {
+		{"PM square", [](Oscillator::PM & osc) { return osc.square(0); }, {}},
+		{"PM square BLEP", [](Oscillator::PM & osc) { return osc.square_blep(0); }, {}},
+		{"PM triangle", [](Oscillator::PM & osc) { return osc.triangle(0); }, {}},
+		{"PM triangle BLAMP", [](Oscillator::PM & osc) { return osc.triangle_blamp(0); }, {}},
+		{"PM saw", [](Oscillator::PM & osc) { return osc.saw(0); }, {}},
+		{"PM saw BLEP", [](Oscillator::PM & osc) { return osc.saw_blep(0); }, {}},
+		{"Basic saw", {}, [](Oscillator::Basic & osc) { return osc.saw(); }},
+		{"Basic saw BLEP", {}, [](Oscillator::Basic & osc) { return osc.saw_blep(); }},
+	};
+
+	fmt::print("Aliasing in dB relative to the total energy, at {} Hz sample rate\n", sample_rate);
+	fmt::print("{:18}", "Key");
+
+	for (int key = 21; key <= 117; key += 12) {
+		fmt::print(" {:6}", key);
+	}
+
+	fmt::print(" {:>9}\n", "ns/sample");
+
+	for (auto &waveform : waveforms) {
+		fmt::print("{:18}", waveform.name);
+		clock::duration duration{};
+
+		// Avoid frequencies that are an exact divisor of the sample rate
+		for (int key = 21; key <= 117; key += 12) {
+			float frequency = key_to_frequency(key + 0.01f);
+			auto begin = clock::now();
+
+			if (waveform.pm) {
+				Oscillator::PM osc;
+
+				for (auto &sample : output) {
+					osc.update(frequency / sample_rate);
+					sample = waveform.pm(osc);
+				}
+			} else {
+				Oscillator::Basic osc(frequency);
+
+				for (auto &sample : output) {
+					sample = waveform.basic(osc);
+					osc.update();
+				}
+			}
+
+			duration += clock::now() - begin;
+			fmt::print(" {:6.1f}", measure_aliasing(output, frequency));
+		}
+
+		fmt::print(" {:9.2f}\n", std::chrono::duration<double, std::nano>(duration).count() / (length * 9));
+	}
+}
+
+int benchmark(int argc, char *argv[])
+{
+	std::string which = "all";
+	std::string json_filename;
+
+	for (int i = 0; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if (arg == "--json" && i + 1 < argc) {
+			json_filename = argv[++i];
+		} else if (arg == "all" || arg == "engines" || arg == "dsp" || arg == "oscillators" || arg == "aliasing") {
+			which = arg;
+		} else {
+			fmt::print(std::cerr, "Usage: pling benchmark [all|engines|dsp|oscillators|aliasing] [--json <file>]\n");
+			return 1;
+		}
+	}
+
+	if (which == "oscillators") {
+		benchmark_oscillators();
+		return 0;
+	} else if (which == "aliasing") {
+		benchmark_aliasing();
+		return 0;
+	}
+
+	std::vector<Result> results;
+	print_header();
+
+	if (which == "all" || which == "engines") {
+		benchmark_engines(results);
+	}
+
+	if (which == "all" || which == "dsp") {
+		benchmark_dsp(results);
+	}
+
+	if (json_filename == "-") {
+		write_json(std::cout, results);
+	} else if (!json_filename.empty()) {
+		std::ofstream file(json_filename);
+		write_json(file, results);
+		file.close();
+
+		if (file.fail()) {
+			fmt::print(std::cerr, "Could not write to {}\n", json_filename);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+/**
+ * Run the benchmarks selected on the command line.
+ *
+ * Usage: pling benchmark [all|engines|dsp|oscillators|aliasing] [--json <file>]
+ *
+ * The engine and DSP benchmarks report ns/sample, the real-time factor,
+ * and the median, 99th percentile and maximum time per chunk.
+ * With --json, these results are also written to the given file ("-" for standard output).
+ *
+ * @return The exit code of the program.
+ */
+int benchmark(int argc, char *argv[]);
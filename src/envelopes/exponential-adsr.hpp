@@ -13,7 +13,7 @@ namespace Envelope
 class ExponentialADSR
 {
 	float amplitude{};
-	const float cutoff = 1.0e-4;
+	static constexpr float cutoff = 1.0e-4;
 	enum class State {
 		off,
 		attack,
@@ -96,6 +96,11 @@ public:
 	}
 
 	float update(const Parameters &param);
+
+	float get() const
+	{
+		return amplitude;
+	}
 };
 
 }
@@ -11,7 +11,7 @@
 namespace Envelope
 {
 
-float ExponentialDX7::update(const Parameters &param, float rate_scaling)
+float ExponentialDX7::update_level(const Parameters &param, float rate_scaling)
 {
 	float dt = rate_scaling / sample_rate;
 
@@ -65,7 +65,7 @@ float ExponentialDX7::update(const Parameters &param, float rate_scaling)
 		amplitude = 0;
 	}
 
-	return dB_to_amplitude(amplitude);
+	return amplitude;
 }
 
 void ExponentialDX7::reinit(const Parameters &param)
@@ -59,7 +59,17 @@ public:
 		duration = param.duration[3];
 	}
 
-	float update(const Parameters &param, float rate_scaling = 1.0f);
+	/**
+	 * Advance the envelope by one sample.
+	 *
+	 * @return The new level in dB.
+	 */
+	float update_level(const Parameters &param, float rate_scaling = 1.0f);
+
+	float update(const Parameters &param, float rate_scaling = 1.0f)
+	{
+		return dB_to_amplitude(update_level(param, rate_scaling));
+	}
 
 	float get() const
 	{
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "half-band-decimator.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "../simd.hpp"
+
+namespace Filter
+{
+
+/* The coefficients of the odd taps, from the oldest to the newest input sample.
+ * These are a Kaiser windowed sinc, normalized so the filter has unity gain at DC. */
+const std::array<float, 2 * HalfBandDecimator::taps> HalfBandDecimator::coefficients = [] {
+	static const double beta = 8;
+	std::array<float, 2 * taps> coefficients;
+	double sum{};
+
+	for (size_t j = 0; j < 2 * taps; ++j) {
+		double offset = 2.0 * j - 2.0 * taps + 1;
+		double x = offset / (2 * taps);
+		double window = std::cyl_bessel_i(0, beta * std::sqrt(1 - x * x)) / std::cyl_bessel_i(0, beta);
+		coefficients[j] = std::sin(M_PI * offset / 2) / (M_PI * offset) * window;
+		sum += coefficients[j];
+	}
+
+	for (auto &coefficient : coefficients) {
+		coefficient *= 0.5 / sum;
+	}
+
+	return coefficients;
+}();
+
+void HalfBandDecimator::reset()
+{
+	even.fill({});
+	odd.fill({});
+}
+
+PLING_TARGET_CLONES void HalfBandDecimator::process(const float *input, float *output, size_t count)
+{
+	using SIMD::vfloat;
+
+	assert(count % (2 * SIMD::lanes) == 0 && count <= max_input);
+	const size_t half = count / 2;
+	float *new_even = even.data() + 2 * taps - 1;
+	float *new_odd = odd.data() + taps;
+
+	for (size_t i = 0; i < half; ++i) {
+		new_even[i] = input[2 * i];
+		new_odd[i] = input[2 * i + 1];
+	}
+
+	/* The center tap only sees odd input samples, the other taps only even ones.
+	 * Calculate SIMD::lanes output samples at a time. */
+	for (size_t n = 0; n < half; n += SIMD::lanes) {
+		vfloat out = SIMD::load(&odd[n]) * 0.5f;
+
+		for (size_t j = 0; j < 2 * taps; ++j) {
+			out += SIMD::load(&even[n + j]) * coefficients[j];
+		}
+
+		SIMD::store(output + n, out);
+	}
+
+	// Keep the history needed for the next block
+	std::memmove(even.data(), even.data() + half, (2 * taps - 1) * sizeof(float));
+	std::memmove(odd.data(), odd.data() + half, taps * sizeof(float));
+}
+
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+#include "../pling.hpp"
+
+namespace Filter
+{
+
+/**
+ * A half-band low-pass filter that decimates its input by a factor of two.
+ *
+ * This is a linear phase FIR filter with 4 * taps - 1 coefficients,
+ * of which only the center one and every other one are non-zero.
+ * It is implemented as a polyphase filter, so only the non-zero coefficients are used,
+ * and only the output samples that are kept are calculated.
+ * With the default number of taps, the passband goes up to 0.45 times the output sample rate,
+ * and the stopband attenuation is about 80 dB.
+ */
+class HalfBandDecimator
+{
+public:
+	static const size_t taps = 32;
+	static const size_t max_input = 4 * chunk_size;
+
+private:
+	static const std::array<float, 2 * taps> coefficients;
+
+	// The even and odd input samples, preceded by the history the filter needs.
+	std::array<float, 2 * taps - 1 + max_input / 2> even{};
+	std::array<float, taps + max_input / 2> odd{};
+
+public:
+	void reset();
+
+	/**
+	 * Filter and decimate a block of samples.
+	 *
+	 * @param input   The input samples.
+	 * @param output  Where to store count / 2 output samples.
+	 * @param count   The number of input samples, which must be a multiple of 16,
+	 *                and at most max_input.
+	 */
+	void process(const float *input, float *output, size_t count);
+};
+
+}
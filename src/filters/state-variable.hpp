@@ -51,7 +51,7 @@ public:
 		bool build_widget(const std::string &name);
 	};
 
-	float filter(Parameters &params, float in)
+	float filter(const Parameters &params, float in)
 	{
 		if (params.type == Parameters::Type::none) {
 			return in;
@@ -111,7 +111,7 @@ public:
 		}
 	}
 
-	float operator()(Parameters &params, float in)
+	float operator()(const Parameters &params, float in)
 	{
 		return filter(params, in);
 	}
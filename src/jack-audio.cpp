@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "jack-audio.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/ostream.h>
+#include <iostream>
+#include <jack/midiport.h>
+#include <stdexcept>
+
+#include "program-manager.hpp"
+#include "render-monitor.hpp"
+
+JackAudio::~JackAudio()
+{
+	stop();
+
+	if (client) {
+		jack_client_close(client);
+	}
+}
+
+void JackAudio::open(const std::string &client_name)
+{
+	jack_status_t status;
+	client = jack_client_open(client_name.c_str(), JackNoStartServer, &status);
+
+	if (!client) {
+		throw std::runtime_error(fmt::format("Could not connect to the JACK server, status {:#x}", unsigned(status)));
+	}
+
+	outputs[0] = jack_port_register(client, "out_left", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	outputs[1] = jack_port_register(client, "out_right", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+	midi_input = jack_port_register(client, "midi_in", JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+
+	if (!outputs[0] || !outputs[1] || !midi_input) {
+		throw std::runtime_error("Could not register JACK ports");
+	}
+
+	jack_set_process_callback(client, process, this);
+	jack_set_buffer_size_callback(client, set_buffer_size, this);
+	jack_set_sample_rate_callback(client, set_sample_rate, this);
+	jack_on_shutdown(client, shutdown, this);
+
+	rate = jack_get_sample_rate(client);
+	buffer_size = jack_get_buffer_size(client);
+	midi_port = &MIDI::manager.add_external_port(jack_get_client_name(client));
+}
+
+void JackAudio::start(RenderFunction render, bool autoconnect)
+{
+	this->render = render;
+
+	if (jack_activate(client)) {
+		throw std::runtime_error("Could not activate the JACK client");
+	}
+
+	running = true;
+
+	if (!autoconnect) {
+		return;
+	}
+
+	// Ports can only be connected once the client is active.
+	const char **playback = jack_get_ports(client, nullptr, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+
+	for (size_t i = 0; playback && i < 2 && playback[i]; ++i) {
+		if (jack_connect(client, jack_port_name(outputs[i]), playback[i])) {
+			fmt::print(std::cerr, "Could not connect to {}\n", playback[i]);
+		}
+	}
+
+	jack_free(playback);
+}
+
+void JackAudio::stop()
+{
+	if (running) {
+		jack_deactivate(client);
+		running = false;
+	}
+}
+
+int JackAudio::process(jack_nframes_t nframes, void *arg)
+{
+	auto self = static_cast<JackAudio *>(arg);
+	self->process_midi(nframes);
+	self->process_audio(nframes);
+	return 0;
+}
+
+int JackAudio::set_buffer_size(jack_nframes_t nframes, void *arg)
+{
+	// Any buffer size works, since chunks are split over periods if needed, but callbacks now come at a different rate.
+	static_cast<JackAudio *>(arg)->buffer_size = nframes;
+	render_monitor.set_period_size(nframes);
+	return 0;
+}
+
+int JackAudio::set_sample_rate(jack_nframes_t nframes, void *arg)
+{
+	auto self = static_cast<JackAudio *>(arg);
+
+	// This is also called on activation, with the rate the client was opened with.
+	if (self->rate.exchange(nframes) == nframes) {
+		return 0;
+	}
+
+	// Notes that are already playing keep their old rate, new notes and the render deadline follow the new one.
+	fmt::print(std::cerr, "JACK sample rate changed to {} Hz\n", nframes);
+	sample_rate = nframes;
+	render_monitor.set_sample_rate(nframes);
+	return 0;
+}
+
+void JackAudio::shutdown(void *arg)
+{
+	fmt::print(std::cerr, "The JACK server has shut down\n");
+}
+
+void JackAudio::process_midi(jack_nframes_t nframes)
+{
+	void *buffer = jack_port_get_buffer(midi_input, nframes);
+	auto count = jack_midi_get_event_count(buffer);
+	bool queued = false;
+
+	/* The MIDI thread only gets to the events while this period is being rendered,
+	 * so play them one period later, at the same offset within the period, plus the chunk of latency all events get.
+	 * The first frame of this period is the part of the last chunk that is still staged. */
+	int64_t next_period = programs.get_render_frame() - int64_t(chunk_size - staging_position) + nframes;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		jack_midi_event_t event;
+
+		if (jack_midi_event_get(&event, buffer, i) == 0) {
+			queued |= MIDI::manager.queue_external_event(*midi_port, event.buffer, event.size, next_period + event.time);
+		}
+	}
+
+	if (queued) {
+		MIDI::manager.notify_external_events();
+	}
+}
+
+void JackAudio::process_audio(jack_nframes_t nframes)
+{
+	auto left = static_cast<float *>(jack_port_get_buffer(outputs[0], nframes));
+	auto right = static_cast<float *>(jack_port_get_buffer(outputs[1], nframes));
+	float *out = left;
+	size_t remaining = nframes;
+
+	while (remaining) {
+		if (staging_position == chunk_size) {
+			if (remaining >= chunk_size) {
+				render(reinterpret_cast<uint8_t *>(out));
+				out += chunk_size;
+				remaining -= chunk_size;
+				continue;
+			}
+
+			render(reinterpret_cast<uint8_t *>(staging.data()));
+			staging_position = 0;
+		}
+
+		size_t n = std::min(chunk_size - staging_position, remaining);
+		std::copy_n(staging.data() + staging_position, n, out);
+		staging_position += n;
+		out += n;
+		remaining -= n;
+	}
+
+	memcpy(right, left, nframes * sizeof *left);
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <jack/jack.h>
+#include <string>
+
+#include "midi.hpp"
+#include "pling.hpp"
+
+/**
+ * Audio output and MIDI input as a JACK client.
+ *
+ * The process callback renders chunks straight into the buffer of the left output port,
+ * whatever JACK's buffer size is, and copies them to the right one.
+ * MIDI messages from the input port are handed to the MIDI manager,
+ * which processes them like events from the ALSA sequencer,
+ * except that they keep their timing within a period, at a constant latency of one period plus one chunk.
+ */
+class JackAudio
+{
+public:
+	// Renders one chunk as mono 32-bit float samples.
+	using RenderFunction = void (*)(uint8_t *output);
+
+	JackAudio() = default;
+	~JackAudio();
+
+	JackAudio(const JackAudio &other) = delete;
+	JackAudio(JackAudio &&other) = delete;
+	JackAudio &operator=(const JackAudio &other) = delete;
+
+	/**
+	 * Connect to the JACK server, and register the ports. Must be called before the MIDI manager is started.
+	 */
+	void open(const std::string &client_name);
+
+	/**
+	 * Start processing.
+	 *
+	 * @param autoconnect  Connect the outputs to the first two physical playback ports.
+	 */
+	void start(RenderFunction render, bool autoconnect);
+	void stop();
+
+	unsigned int get_rate() const
+	{
+		return rate.load(std::memory_order_relaxed);
+	}
+
+	unsigned int get_buffer_size() const
+	{
+		return buffer_size.load(std::memory_order_relaxed);
+	}
+
+private:
+	jack_client_t *client{};
+	jack_port_t *outputs[2]{};
+	jack_port_t *midi_input{};
+	MIDI::Port *midi_port{};
+	RenderFunction render{};
+	bool running{};
+
+	std::atomic<unsigned int> rate{};
+	std::atomic<unsigned int> buffer_size{};
+
+	// Holds the part of the last rendered chunk that did not fit in the previous period.
+	std::array<float, chunk_size> staging;
+	size_t staging_position{chunk_size};
+
+	static int process(jack_nframes_t nframes, void *arg);
+	static int set_buffer_size(jack_nframes_t nframes, void *arg);
+	static int set_sample_rate(jack_nframes_t nframes, void *arg);
+	static void shutdown(void *arg);
+
+	void process_midi(jack_nframes_t nframes);
+	void process_audio(jack_nframes_t nframes);
+};
@@ -0,0 +1,222 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "midi-file.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace MIDI
+{
+
+namespace
+{
+
+class Reader
+{
+	const uint8_t *ptr;
+	const uint8_t *end;
+
+public:
+	Reader(const uint8_t *begin, const uint8_t *end): ptr(begin), end(end) {}
+
+	bool empty() const
+	{
+		return ptr == end;
+	}
+
+	const uint8_t *get(size_t size)
+	{
+		if (size_t(end - ptr) < size) {
+			throw std::runtime_error("Unexpected end of MIDI file");
+		}
+
+		auto result = ptr;
+		ptr += size;
+		return result;
+	}
+
+	Reader get_reader(size_t size)
+	{
+		auto begin = get(size);
+		return Reader(begin, begin + size);
+	}
+
+	uint8_t get_byte()
+	{
+		return *get(1);
+	}
+
+	uint32_t get_uint(size_t size)
+	{
+		uint32_t value = 0;
+
+		for (auto data = get(size); size--;) {
+			value = value << 8 | *data++;
+		}
+
+		return value;
+	}
+
+	uint32_t get_varlen()
+	{
+		uint32_t value = 0;
+
+		for (int i = 0; i < 4; ++i) {
+			auto byte = get_byte();
+			value = value << 7 | (byte & 0x7f);
+
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+
+		throw std::runtime_error("Invalid variable-length quantity in MIDI file");
+	}
+};
+
+struct TrackEvent {
+	uint64_t tick;
+	uint8_t status;
+	uint8_t data[2];
+};
+
+struct TempoChange {
+	uint64_t tick;
+	uint32_t tempo; // in microseconds per quarter note
+};
+
+}
+
+static void parse_track(Reader in, std::vector<TrackEvent> &events, std::vector<TempoChange> &tempos)
+{
+	uint64_t tick = 0;
+	uint8_t status = 0;
+
+	while (!in.empty()) {
+		tick += in.get_varlen();
+		auto byte = in.get_byte();
+
+		if (byte == 0xff) {
+			auto type = in.get_byte();
+			auto length = in.get_varlen();
+			auto data = in.get_reader(length);
+
+			if (type == 0x2f) {
+				break;
+			} else if (type == 0x51 && length == 3) {
+				tempos.push_back({tick, data.get_uint(3)});
+			}
+
+			continue;
+		}
+
+		if (byte == 0xf0 || byte == 0xf7) {
+			in.get(in.get_varlen());
+			status = 0;
+			continue;
+		}
+
+		// Running status
+		if (byte & 0x80) {
+			status = byte;
+			byte = in.get_byte();
+		} else if (!status) {
+			throw std::runtime_error("Invalid running status in MIDI file");
+		}
+
+		TrackEvent event{tick, status, {byte, 0}};
+
+		if ((status & 0xf0) != 0xc0 && (status & 0xf0) != 0xd0) {
+			event.data[1] = in.get_byte();
+		}
+
+		events.push_back(event);
+	}
+}
+
+File::File(const std::filesystem::path &filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+
+	if (!file) {
+		throw std::runtime_error("Could not open " + filename.native());
+	}
+
+	std::vector<uint8_t> contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	Reader in(contents.data(), contents.data() + contents.size());
+
+	if (std::string(reinterpret_cast<const char *>(in.get(4)), 4) != "MThd") {
+		throw std::runtime_error(filename.native() + " is not a MIDI file");
+	}
+
+	auto header = in.get_reader(in.get_uint(4));
+	header.get_uint(2); // All formats are handled the same way
+	auto ntracks = header.get_uint(2);
+	auto division = header.get_uint(2);
+
+	std::vector<TrackEvent> track_events;
+	std::vector<TempoChange> tempos;
+
+	while (ntracks && !in.empty()) {
+		auto type = std::string(reinterpret_cast<const char *>(in.get(4)), 4);
+		auto length = in.get_uint(4);
+		auto chunk = in.get_reader(length);
+
+		if (type == "MTrk") {
+			parse_track(chunk, track_events, tempos);
+			ntracks--;
+		}
+	}
+
+	// Merge the tracks. For simultaneous events, keep the order of the tracks they came from.
+	std::stable_sort(track_events.begin(), track_events.end(), [](auto & a, auto & b) {
+		return a.tick < b.tick;
+	});
+
+	std::stable_sort(tempos.begin(), tempos.end(), [](auto & a, auto & b) {
+		return a.tick < b.tick;
+	});
+
+	// Convert ticks to seconds, following the tempo map.
+	events.reserve(track_events.size());
+
+	if (division & 0x8000) {
+		// SMPTE time code, with a fixed number of ticks per frame.
+		double frames_per_second = -int8_t(division >> 8);
+		double ticks_per_frame = division & 0xff;
+
+		if (frames_per_second == 29) {
+			frames_per_second = 29.97;
+		}
+
+		for (auto &event : track_events) {
+			events.push_back({event.tick / (frames_per_second * ticks_per_frame), event.status, {event.data[0], event.data[1]}});
+		}
+	} else {
+		if (!division) {
+			throw std::runtime_error(filename.native() + " has an invalid time division");
+		}
+
+		auto tempo = tempos.begin();
+		uint64_t tick = 0;
+		double time = 0;
+		double seconds_per_tick = 0.5 / division;
+
+		for (auto &event : track_events) {
+			for (; tempo != tempos.end() && tempo->tick <= event.tick; ++tempo) {
+				time += (tempo->tick - tick) * seconds_per_tick;
+				tick = tempo->tick;
+				seconds_per_tick = tempo->tempo * 1e-6 / division;
+			}
+
+			time += (event.tick - tick) * seconds_per_tick;
+			tick = event.tick;
+			events.push_back({time, event.status, {event.data[0], event.data[1]}});
+		}
+	}
+}
+
+}
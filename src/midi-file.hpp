@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace MIDI
+{
+
+/**
+ * A Standard MIDI File.
+ *
+ * All tracks are merged into a single list of channel events, sorted by time.
+ * Meta events other than tempo changes, and system exclusive events, are skipped.
+ */
+class File
+{
+public:
+	struct Event {
+		double time; // in seconds
+		uint8_t status;
+		uint8_t data[2];
+	};
+
+	/**
+	 * Read a Standard MIDI File.
+	 *
+	 * @throws std::runtime_error if the file could not be read or is not a valid MIDI file.
+	 */
+	explicit File(const std::filesystem::path &filename);
+
+	const std::vector<Event> &get_events() const
+	{
+		return events;
+	}
+
+	double get_duration() const
+	{
+		return events.empty() ? 0 : events.back().time;
+	}
+
+private:
+	std::vector<Event> events;
+};
+
+}
@@ -8,6 +8,7 @@
 #include <fmt/ostream.h>
 #include <fstream>
 #include <stdexcept>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 #include "controller.hpp"
@@ -22,6 +23,11 @@ Port::Port(snd_seq_t *seq, const snd_seq_port_info_t *info)
 	open(seq, info);
 }
 
+Port::Port(const std::string &name): client(external), name(name), hwid(name)
+{
+	controller.load(hwid);
+}
+
 Port::~Port()
 {
 	close();
@@ -57,7 +63,7 @@ void Port::open(snd_seq_t *seq, const snd_seq_port_info_t *info)
 
 bool Port::is_match(snd_seq_t *seq, const snd_seq_port_info_t *info)
 {
-	if (name != snd_seq_port_info_get_name(info)) {
+	if (client == external || name != snd_seq_port_info_get_name(info)) {
 		return false;
 	}
 
@@ -94,7 +100,9 @@ void Port::close()
 void Port::panic()
 {
 	for (auto &channel : channels) {
-		channel.program->release_all();
+		if (channel.get_program()) {
+			programs.queue(channel.program, {Program::Event::Type::RELEASE_ALL});
+		}
 	}
 }
 
@@ -118,6 +126,19 @@ Manager::Manager(Program::Manager &programs): programs(programs)
 	auto &pfd = pfds.emplace_back();
 	pfd.fd = pipe_fds[0];
 	pfd.events = POLLIN | POLLERR | POLLHUP;
+
+	// Add an eventfd that signals external events.
+	external_event_fd = eventfd(0, EFD_NONBLOCK);
+
+	if (external_event_fd == -1) {
+		throw std::runtime_error("Could not create eventfd");
+	}
+
+	auto &external_pfd = pfds.emplace_back();
+	external_pfd.fd = external_event_fd;
+	external_pfd.events = POLLIN;
+
+	snd_midi_event_new(16, &event_parser);
 }
 
 Manager::~Manager()
@@ -129,6 +150,8 @@ Manager::~Manager()
 
 	close(pipe_fds[0]);
 	close(pipe_fds[1]);
+	close(external_event_fd);
+	snd_midi_event_free(event_parser);
 
 	snd_seq_delete_port(seq, 0);
 	snd_seq_close(seq);
@@ -184,17 +207,13 @@ void Manager::add_port(const snd_seq_port_info_t *pinfo)
 		state.set_active_channel(port, 0);
 		last_active_port = &port;
 	}
-
-	for (auto &channel : port.channels) {
-		programs.change(channel.program, 0);
-	}
 }
 
 void Manager::update_pfds()
 {
 	auto npfds = snd_seq_poll_descriptors_count(seq, POLLIN);
-	pfds.resize(npfds + 1);
-	snd_seq_poll_descriptors(seq, pfds.data() + 1, npfds, POLLIN);
+	pfds.resize(npfds + 2);
+	snd_seq_poll_descriptors(seq, pfds.data() + 2, npfds, POLLIN);
 }
 
 void Manager::scan_ports()
@@ -263,6 +282,29 @@ void Manager::process_system_event(const snd_seq_event_t &event)
 
 }
 
+/**
+ * Whether an event needs a program on its channel.
+ * Events that only affect notes that are already playing do not.
+ */
+static bool needs_program(const snd_seq_event_t &event)
+{
+	switch (event.type) {
+	case SND_SEQ_EVENT_NOTEON:
+		return event.data.note.velocity;
+
+	case SND_SEQ_EVENT_CONTROLLER:
+		return event.data.control.param == MIDI_CTL_MSB_MODWHEEL || event.data.control.param == MIDI_CTL_SUSTAIN;
+
+	case SND_SEQ_EVENT_PGMCHANGE:
+	case SND_SEQ_EVENT_CHANPRESS:
+	case SND_SEQ_EVENT_PITCHBEND:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 void Manager::process_seq_event(const snd_seq_event_t &event)
 {
 	auto port_it = std::find_if(ports.begin(), ports.end(), [event](const auto & port) {
@@ -279,8 +321,11 @@ void Manager::process_seq_event(const snd_seq_event_t &event)
 		return;
 	}
 
-	auto &port = *port_it;
+	process_port_event(*port_it, event);
+}
 
+void Manager::process_port_event(Port &port, const snd_seq_event_t &event, std::optional<int64_t> frame)
+{
 	Control control = port.controller.map(event);
 
 	if (control.command != Command::PASS) {
@@ -306,38 +351,60 @@ void Manager::process_seq_event(const snd_seq_event_t &event)
 	}
 
 	auto &channel = port.channels[event.data.control.channel & 0xf];
-	auto program = channel.program;
+	// The program can be replaced by the loader at any time, so pass the slot itself to the program manager.
+	auto &program = channel.program;
+	using Type = Program::Event::Type;
+
+	// Events that come with a frame keep their timing, others are timestamped when they are queued.
+	auto queue = [&](Program::Event program_event) {
+		if (frame) {
+			programs.queue(program, program_event, *frame);
+		} else {
+			programs.queue(program, program_event);
+		}
+	};
+
+	// Channels get their first program when they are first used.
+	if (!channel.get_program()) {
+		if (!needs_program(event)) {
+			return;
+		}
+
+		if (event.type != SND_SEQ_EVENT_PGMCHANGE) {
+			programs.change(program, 0);
+		}
+	}
 
 	switch (event.type) {
 	case SND_SEQ_EVENT_NOTEON:
 		if (event.data.note.velocity) {
 			programs.activate(program);
-			program->note_on(event.data.note.note, event.data.note.velocity);
+			queue({Type::NOTE_ON, event.data.note.note, event.data.note.velocity});
 			state.note_on(event.data.note.note, event.data.note.velocity);
 		} else {
-			program->note_off(event.data.note.note, event.data.note.velocity);
+			queue({Type::NOTE_OFF, event.data.note.note, event.data.note.velocity});
 			state.note_off(event.data.note.note);
 		}
 
 		break;
 
 	case SND_SEQ_EVENT_NOTEOFF:
-		program->note_off(event.data.note.note, event.data.note.velocity);
+		queue({Type::NOTE_OFF, event.data.note.note, event.data.note.velocity});
 		state.note_off(event.data.note.note);
 		break;
 
 	case SND_SEQ_EVENT_KEYPRESS: // Polyphonic pressure
-		program->poly_pressure(event.data.note.note, event.data.note.velocity);
+		queue({Type::POLY_PRESSURE, event.data.note.note, event.data.note.velocity});
 		break;
 
 	case SND_SEQ_EVENT_CONTROLLER:
 		switch (event.data.control.param) {
 		case MIDI_CTL_MSB_MODWHEEL:
-			program->modulation(event.data.control.value);
+			queue({Type::MODULATION, 0, uint8_t(event.data.control.value)});
 			break;
 
 		case MIDI_CTL_SUSTAIN:
-			program->sustain(event.data.control.value & 64);
+			queue({Type::SUSTAIN, 0, uint8_t(event.data.control.value & 64)});
 			break;
 
 		default:
@@ -349,15 +416,15 @@ void Manager::process_seq_event(const snd_seq_event_t &event)
 	case SND_SEQ_EVENT_PGMCHANGE:
 		state.set_active_channel(port, event.data.control.channel);
 		programs.change(channel.program, event.data.control.value);
-		state.set_active_program(channel.program);
+		state.set_active_program(channel.get_program());
 		break;
 
 	case SND_SEQ_EVENT_CHANPRESS:
-		program->channel_pressure(event.data.control.value);
+		queue({Type::CHANNEL_PRESSURE, 0, uint8_t(event.data.control.value)});
 		break;
 
 	case SND_SEQ_EVENT_PITCHBEND:
-		program->pitch_bend(event.data.control.value);
+		queue({Type::PITCH_BEND, 0, 0, int16_t(event.data.control.value)});
 		state.set_bend(event.data.control.value);
 		break;
 
@@ -384,7 +451,21 @@ void Manager::process_events()
 			break;
 		}
 
-		// Else, assume we got a sequencer event
+		if (pfds[1].revents) {
+			process_external_events();
+		}
+
+		bool have_seq_events = false;
+
+		for (size_t i = 2; i < pfds.size(); ++i) {
+			have_seq_events |= pfds[i].revents != 0;
+		}
+
+		if (!have_seq_events) {
+			continue;
+		}
+
+		// The rest are sequencer events
 		while (true) {
 			snd_seq_event_t *event;
 			auto left = snd_seq_event_input(seq, &event);
@@ -400,6 +481,54 @@ void Manager::process_events()
 	}
 }
 
+Port &Manager::add_external_port(const std::string &name)
+{
+	bool is_first_port = ports.empty();
+	Port &port = ports.emplace_back(name);
+
+	if (is_first_port) {
+		state.set_active_channel(port, 0);
+		last_active_port = &port;
+	}
+
+	return port;
+}
+
+bool Manager::queue_external_event(Port &port, const uint8_t *data, size_t size, int64_t frame)
+{
+	if (!size || size > sizeof ExternalEvent::data) {
+		return false;
+	}
+
+	ExternalEvent event{&port, frame, uint8_t(size), {}};
+	std::copy(data, data + size, event.data);
+	return external_events.push(event);
+}
+
+void Manager::notify_external_events()
+{
+	uint64_t count = 1;
+	write(external_event_fd, &count, sizeof count);
+}
+
+void Manager::process_external_events()
+{
+	uint64_t count;
+	read(external_event_fd, &count, sizeof count);
+
+	// Convert them to sequencer events, so they take exactly the same path as events from ALSA.
+	while (auto external = external_events.front()) {
+		snd_seq_event_t event{};
+		snd_midi_event_reset_encode(event_parser);
+
+		if (snd_midi_event_encode(event_parser, external->data, external->size, &event) > 0 && event.type != SND_SEQ_EVENT_NONE) {
+			process_port_event(*external->port, event, external->frame);
+		}
+
+		external_events.pop();
+	}
+}
+
 void Manager::panic()
 {
 	for (auto &port : ports) {
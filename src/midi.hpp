@@ -8,6 +8,7 @@
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <poll.h>
 #include <string>
 #include <thread>
@@ -15,6 +16,7 @@
 
 #include "controller.hpp"
 #include "program-manager.hpp"
+#include "spsc-queue.hpp"
 
 namespace MIDI
 {
@@ -23,7 +25,13 @@ namespace MIDI
  * The state for a MIDI channel.
  */
 struct Channel {
+	// Replaced by the program loader thread, so only access it atomically.
 	std::shared_ptr<Program> program;
+
+	std::shared_ptr<Program> get_program() const
+	{
+		return std::atomic_load(&program);
+	}
 };
 
 /**
@@ -46,7 +54,11 @@ class Port
 	Channel channels[16];
 
 public:
+	// The client number of ports that are not connected via the ALSA sequencer, such as JACK MIDI inputs.
+	static const int external = -2;
+
 	Port(snd_seq_t *seq, const snd_seq_port_info_t *info);
+	explicit Port(const std::string &name);
 	~Port();
 
 	Port(const Port &other) = delete;
@@ -106,11 +118,24 @@ class Manager
 	snd_seq_t *seq{};
 	snd_midi_event_t *event_parser{};
 
+	// Raw MIDI messages from external ports, handed over by a real-time thread.
+	struct ExternalEvent {
+		Port *port;
+		int64_t frame;
+		uint8_t size;
+		uint8_t data[3];
+	};
+
+	SPSCQueue<ExternalEvent, 1024> external_events;
+	int external_event_fd{-1};
+
 	void update_pfds();
 	void add_port(const snd_seq_port_info_t *pinfo);
 	void process_midi_command(Port &port, const uint8_t *data, ssize_t len);
 	void process_system_event(const snd_seq_event_t &event);
 	void process_seq_event(const snd_seq_event_t &event);
+	void process_port_event(Port &port, const snd_seq_event_t &event, std::optional<int64_t> frame = {});
+	void process_external_events();
 	void process_events();
 	void scan_ports();
 
@@ -125,6 +150,25 @@ public:
 	void start();
 	void panic();
 
+	/**
+	 * Add a port that receives MIDI from outside the ALSA sequencer. Must be called before start().
+	 */
+	Port &add_external_port(const std::string &name);
+
+	/**
+	 * Queue a MIDI message received on an external port, without blocking.
+	 * Only one thread may call this. System exclusive and other messages longer than 3 bytes are ignored.
+	 *
+	 * @param frame  The frame at which to apply the message, see Program::Manager::queue().
+	 * @return       False if the message was not queued.
+	 */
+	bool queue_external_event(Port &port, const uint8_t *data, size_t size, int64_t frame);
+
+	/**
+	 * Wake up the MIDI thread to process the queued external events.
+	 */
+	void notify_external_events();
+
 	std::deque<Port> &get_ports()
 	{
 		return ports;
@@ -0,0 +1,195 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "offline-render.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "midi-file.hpp"
+#include "pling.hpp"
+#include "program-manager.hpp"
+
+// Stop rendering if programs are still not silent this long after the last event.
+static const double max_tail = 30;
+
+static void put_u16(std::ostream &out, uint16_t value)
+{
+	char bytes[2] = {char(value), char(value >> 8)};
+	out.write(bytes, sizeof bytes);
+}
+
+static void put_u32(std::ostream &out, uint32_t value)
+{
+	char bytes[4] = {char(value), char(value >> 8), char(value >> 16), char(value >> 24)};
+	out.write(bytes, sizeof bytes);
+}
+
+/**
+ * Write mono 32-bit floating point samples to a WAV file.
+ */
+static void write_wav(const std::filesystem::path &filename, const std::vector<float> &samples)
+{
+	std::ofstream file(filename, std::ios::binary);
+	uint32_t data_size = samples.size() * sizeof(float);
+
+	file.write("RIFF", 4);
+	put_u32(file, 4 + (8 + 18) + (8 + 4) + (8 + data_size));
+	file.write("WAVE", 4);
+
+	file.write("fmt ", 4);
+	put_u32(file, 18);
+	put_u16(file, 3); // WAVE_FORMAT_IEEE_FLOAT
+	put_u16(file, 1);
+	put_u32(file, sample_rate);
+	put_u32(file, sample_rate * sizeof(float));
+	put_u16(file, sizeof(float));
+	put_u16(file, 32);
+	put_u16(file, 0);
+
+	file.write("fact", 4);
+	put_u32(file, 4);
+	put_u32(file, samples.size());
+
+	file.write("data", 4);
+	put_u32(file, data_size);
+
+	for (auto sample : samples) {
+		uint32_t value;
+		std::memcpy(&value, &sample, sizeof value);
+		put_u32(file, value);
+	}
+
+	file.close();
+
+	if (file.fail()) {
+		throw std::runtime_error("Could not write to " + filename.native());
+	}
+}
+
+/**
+ * Queue a MIDI event, the same way MIDI::Manager does for live input.
+ */
+static void process_event(std::shared_ptr<Program> &program, const MIDI::File::Event &event, int64_t frame)
+{
+	using Type = Program::Event::Type;
+
+	// Channels get their first program when they are first used.
+	if (!program) {
+		programs.change(program, 0);
+	}
+
+	switch (event.status & 0xf0) {
+	case 0x90:
+		if (event.data[1]) {
+			programs.activate(program);
+			programs.queue(program, {Type::NOTE_ON, event.data[0], event.data[1]}, frame);
+		} else {
+			programs.queue(program, {Type::NOTE_OFF, event.data[0], event.data[1]}, frame);
+		}
+
+		break;
+
+	case 0x80:
+		programs.queue(program, {Type::NOTE_OFF, event.data[0], event.data[1]}, frame);
+		break;
+
+	case 0xa0:
+		programs.queue(program, {Type::POLY_PRESSURE, event.data[0], event.data[1]}, frame);
+		break;
+
+	case 0xb0:
+		switch (event.data[0]) {
+		case 1: // Modulation wheel
+			programs.queue(program, {Type::MODULATION, 0, event.data[1]}, frame);
+			break;
+
+		case 64: // Sustain pedal
+			programs.queue(program, {Type::SUSTAIN, 0, uint8_t(event.data[1] & 64)}, frame);
+			break;
+
+		default:
+			break;
+		}
+
+		break;
+
+	case 0xc0:
+		/* Changing a program that is in use happens in the background during live play.
+		 * Here it has to happen at an exact time, so release the old program and load the new one right away. */
+		if (program->get_MIDI_program() != event.data[0]) {
+			programs.queue(program, {Type::RELEASE_ALL}, frame);
+			program.reset();
+			programs.change(program, event.data[0]);
+		}
+
+		break;
+
+	case 0xd0:
+		programs.queue(program, {Type::CHANNEL_PRESSURE, 0, event.data[0]}, frame);
+		break;
+
+	case 0xe0:
+		programs.queue(program, {Type::PITCH_BEND, 0, 0, int16_t((event.data[1] << 7 | event.data[0]) - 8192)}, frame);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void render_midi_file(const std::filesystem::path &input, const std::filesystem::path &output)
+{
+	using clock = std::chrono::steady_clock;
+
+	MIDI::File file(input);
+	const auto &events = file.get_events();
+	std::shared_ptr<Program> channels[16];
+
+	std::vector<float> samples;
+	Chunk chunk;
+	int64_t frame = 0;
+	const int64_t last_frame = (file.get_duration() + max_tail) * sample_rate;
+	float amplitude = 0.25f; // same headroom as live output
+
+	auto begin = clock::now();
+	auto event = events.begin();
+
+	while (true) {
+		// Queue the events that fall within the next chunk at their exact sample.
+		for (; event != events.end(); ++event) {
+			int64_t event_frame = event->time * sample_rate;
+
+			if (event_frame >= frame + int64_t(chunk_size)) {
+				break;
+			}
+
+			process_event(channels[event->status & 0xf], *event, event_frame - chunk_size);
+		}
+
+		bool active = programs.render(chunk);
+
+		for (auto sample : chunk.samples) {
+			samples.push_back(sample * amplitude);
+		}
+
+		frame += chunk_size;
+
+		if (event == events.end() && (!active || frame >= last_frame)) {
+			break;
+		}
+	}
+
+	auto end = clock::now();
+	write_wav(output, samples);
+
+	auto audio_time = double(samples.size()) / sample_rate;
+	auto render_time = std::chrono::duration<double>(end - begin).count();
+	fmt::print(std::cerr, "Rendered {:.2f} s of audio in {:.3f} s, {:.1f}x faster than real time\n", audio_time, render_time, audio_time / render_time);
+}
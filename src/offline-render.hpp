@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <filesystem>
+
+/**
+ * Render a Standard MIDI File to a WAV file, as fast as possible.
+ *
+ * The events are played through the same program manager and engines as live input,
+ * but without audio output. Rendering continues after the last event until all programs are silent.
+ *
+ * @throws std::runtime_error if the MIDI file could not be read or the WAV file could not be written.
+ */
+void render_midi_file(const std::filesystem::path &input, const std::filesystem::path &output);
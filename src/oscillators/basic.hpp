@@ -4,6 +4,7 @@
 
 #include <cmath>
 
+#include "polyblep.hpp"
 #include "../pling.hpp"
 
 namespace Oscillator
@@ -70,6 +71,27 @@ public:
 		return std::abs(phase - 0.5f) * 4.0f - 1.0f;
 	}
 
+	/* Band-limited versions of the above waveforms.
+	 * The bend should be the same as passed to the last call to update(). */
+
+	float square_blep(float bend = 1.0)
+	{
+		float t2 = phase < 0.5f ? phase + 0.5f : phase - 0.5f;
+		return square() + poly_blep(phase, delta * bend) - poly_blep(t2, delta * bend);
+	}
+
+	float saw_blep(float bend = 1.0)
+	{
+		return saw() + poly_blep(phase, delta * bend);
+	}
+
+	float triangle_blamp(float bend = 1.0)
+	{
+		// The top of the triangle is at phase 0, the bottom at phase 0.5.
+		float t2 = phase < 0.5f ? phase + 0.5f : phase - 0.5f;
+		return triangle() + 4.0f * delta * bend * (poly_blamp(t2, delta * bend) - poly_blamp(phase, delta * bend));
+	}
+
 	Basic &operator++()
 	{
 		update();
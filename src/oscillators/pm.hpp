@@ -2,9 +2,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <random>
+#include <string>
 
+#include "polyblep.hpp"
 #include "../pling.hpp"
 
 namespace Oscillator
@@ -14,8 +19,96 @@ class PM
 {
 private:
 	float phase{};
+	float delta{};
+
+	static constexpr size_t table_size = 1024;
+	static inline const std::array<float, table_size + 1> table = [] {
+		std::array<float, table_size + 1> table;
+
+		for (size_t i = 0; i <= table_size; ++i) {
+			table[i] = std::sin(i * (2 * M_PI / table_size));
+		}
+
+		return table;
+	}();
+
+	// std::floor() is a library call on CPUs without SSE4.1, this only uses conversions.
+	static float fast_floor(float x)
+	{
+		float t = float(int32_t(x));
+		return t > x ? t - 1.0f : t;
+	}
 
 public:
+	/**
+	 * The way sine waves are calculated, from slowest and most accurate to fastest.
+	 */
+	enum class Accuracy {
+		LIBM,       // std::sin()
+		POLYNOMIAL, // Minimax polynomial, with a maximum error of about 6e-7
+		WAVETABLE,  // Table lookup with linear interpolation, with a maximum error of about 5e-6
+	};
+
+	static Accuracy parse_accuracy(const std::string &name, Accuracy fallback)
+	{
+		if (name == "libm") {
+			return Accuracy::LIBM;
+		} else if (name == "polynomial") {
+			return Accuracy::POLYNOMIAL;
+		} else if (name == "wavetable") {
+			return Accuracy::WAVETABLE;
+		} else {
+			return fallback;
+		}
+	}
+
+	static const char *get_accuracy_name(Accuracy accuracy)
+	{
+		switch (accuracy) {
+		case Accuracy::LIBM:
+			return "libm";
+
+		case Accuracy::POLYNOMIAL:
+			return "polynomial";
+
+		case Accuracy::WAVETABLE:
+			return "wavetable";
+		}
+
+		return "";
+	}
+
+	/**
+	 * Calculate sin(2 * pi * x) using a minimax polynomial on a quarter period.
+	 */
+	static float sine_polynomial(float x)
+	{
+		// Reduce to -0.5..0.5 turns, then fold into -0.25..0.25 turns.
+		float r = x - fast_floor(x + 0.5f);
+
+		if (r > 0.25f) {
+			r = 0.5f - r;
+		} else if (r < -0.25f) {
+			r = -0.5f - r;
+		}
+
+		float r2 = r * r;
+		return r * (6.28316404f + r2 * (-41.3371424f + r2 * (81.3407689f + r2 * -70.9934333f)));
+	}
+
+	/**
+	 * Calculate sin(2 * pi * x) using a wavetable with linear interpolation.
+	 */
+	static float sine_wavetable(float x)
+	{
+		float position = (x - fast_floor(x)) * table_size;
+
+		// Rounding can cause position to be equal to table_size.
+		size_t i = std::min(size_t(position), table_size - 1);
+		float fraction = position - i;
+		return table[i] + (table[i + 1] - table[i]) * fraction;
+	}
+
 	PM() = default;
 
 	void init(float phase = {})
@@ -30,12 +123,14 @@ public:
 
 	void update(float delta)
 	{
+		this->delta = delta;
 		phase += delta;
 		phase -= std::floor(phase);
 	};
 
 	float update_sync(float delta)
 	{
+		this->delta = delta;
 		float prev = phase;
 		phase += delta;
 		phase -= std::floor(phase);
@@ -47,6 +142,20 @@ public:
 		return std::sin((phase + pm) * float(2 * M_PI));
 	}
 
+	float sine(float pm, Accuracy accuracy) const
+	{
+		switch (accuracy) {
+		case Accuracy::POLYNOMIAL:
+			return sine_polynomial(phase + pm);
+
+		case Accuracy::WAVETABLE:
+			return sine_wavetable(phase + pm);
+
+		default:
+			return sine(pm);
+		}
+	}
+
 	float fast_sine(float pm) const
 	{
 		// Approximation of a sine using a parabola, without using branches.
@@ -76,6 +185,31 @@ public:
 		return frac(pm) * 2.0f - 1.0f;
 	}
 
+	/* Band-limited versions of the above waveforms.
+	 * These use the unmodulated phase increment to determine the width of the correction,
+	 * so with heavy phase modulation they will still alias somewhat. */
+
+	float square_blep(float pm) const
+	{
+		float t = frac(pm);
+		float t2 = t < 0.5f ? t + 0.5f : t - 0.5f;
+		return (t < 0.5f ? 1.0f : -1.0f) + poly_blep(t, delta) - poly_blep(t2, delta);
+	}
+
+	float triangle_blamp(float pm) const
+	{
+		// t is the phase since the top of the triangle, t2 since the bottom.
+		float t = frac(pm - 0.25f);
+		float t2 = t < 0.5f ? t + 0.5f : t - 0.5f;
+		return std::abs(t - 0.5f) * 4.0f - 1.0f + 4.0f * std::abs(delta) * (poly_blamp(t2, delta) - poly_blamp(t, delta));
+	}
+
+	float saw_blep(float pm) const
+	{
+		float t = frac(pm);
+		return t * -2.0f + 1.0f + poly_blep(t, delta);
+	}
+
 	float operator()(float pm) const
 	{
 		return frac(pm);
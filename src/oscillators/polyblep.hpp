@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "../simd.hpp"
+
+namespace Oscillator
+{
+
+/**
+ * Polynomial approximations of band-limited steps and ramps.
+ *
+ * These return the difference between a band-limited and a naive step or ramp,
+ * and have to be added to a naively sampled waveform at each discontinuity.
+ * See doc/ANTI-ALIASING.md.
+ *
+ * @param t   The phase since the discontinuity, in the range 0..1.
+ * @param dt  The phase increment per sample.
+ */
+static inline float poly_blep(float t, float dt)
+{
+	dt = std::min(std::abs(dt), 0.5f);
+
+	if (t < dt) {
+		t /= dt;
+		return t + t - t * t - 1.0f;
+	} else if (t > 1.0f - dt) {
+		t = (t - 1.0f) / dt;
+		return t * t + t + t + 1.0f;
+	} else {
+		return 0.0f;
+	}
+}
+
+static inline float poly_blamp(float t, float dt)
+{
+	dt = std::min(std::abs(dt), 0.5f);
+
+	if (t < dt) {
+		t = t / dt - 1.0f;
+		return t * t * t * (-1.0f / 3.0f);
+	} else if (t > 1.0f - dt) {
+		t = (t - 1.0f) / dt + 1.0f;
+		return t * t * t * (1.0f / 3.0f);
+	} else {
+		return 0.0f;
+	}
+}
+
+PLING_SIMD_INLINE SIMD::vfloat poly_blep(SIMD::vfloat t, SIMD::vfloat dt)
+{
+	dt = SIMD::clamp(SIMD::abs(dt), 0.0f, 0.5f);
+	SIMD::vfloat a = t / dt;
+	SIMD::vfloat b = (t - 1.0f) / dt;
+	SIMD::vfloat result = SIMD::select(t > 1.0f - dt, b * b + b + b + 1.0f, SIMD::vfloat{});
+	return SIMD::select(t < dt, a + a - a * a - 1.0f, result);
+}
+
+PLING_SIMD_INLINE SIMD::vfloat poly_blamp(SIMD::vfloat t, SIMD::vfloat dt)
+{
+	dt = SIMD::clamp(SIMD::abs(dt), 0.0f, 0.5f);
+	SIMD::vfloat a = t / dt - 1.0f;
+	SIMD::vfloat b = (t - 1.0f) / dt + 1.0f;
+	SIMD::vfloat result = SIMD::select(t > 1.0f - dt, b * b * b * (1.0f / 3.0f), SIMD::vfloat{});
+	return SIMD::select(t < dt, a * a * a * (-1.0f / 3.0f), result);
+}
+
+}
@@ -0,0 +1,432 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "patch-cache.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pling.hpp"
+
+namespace fs = std::filesystem;
+
+/* The cache file starts with a header, followed by one Entry for each program in the bank,
+ * followed by the encoded programs. Each encoded program starts with the path of the file it was parsed from.
+ * All integers are stored in native byte order, the cache is never shared between machines. */
+static const char magic[8] = {'P', 'L', 'N', 'G', 'P', 'A', 'T', 'C'};
+static const uint32_t version = 1;
+
+struct Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+};
+
+enum class Tag: uint8_t {
+	NONE,
+	SCALAR,
+	SEQUENCE,
+	MAP,
+};
+
+static fs::path get_program_path(unsigned int bank, uint8_t program)
+{
+	fs::path filename = "programs";
+	filename /= "bank-" + std::to_string(bank);
+	filename /= std::to_string(program) + ".yaml";
+	return config.get_load_path(filename);
+}
+
+static fs::path get_bank_cache_path(unsigned int bank)
+{
+	return config.get_cache_path(fs::path("programs") / ("bank-" + std::to_string(bank) + ".cache"));
+}
+
+static int64_t get_mtime(const struct stat &st)
+{
+	return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static void put_u32(std::string &out, uint32_t value)
+{
+	out.append(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+static void put_string(std::string &out, const std::string &value)
+{
+	put_u32(out, value.size());
+	out.append(value);
+}
+
+static void encode(std::string &out, const YAML::Node &node)
+{
+	switch (node.Type()) {
+	case YAML::NodeType::Scalar:
+		out.push_back(char(Tag::SCALAR));
+		put_string(out, node.Scalar());
+		break;
+
+	case YAML::NodeType::Sequence:
+		out.push_back(char(Tag::SEQUENCE));
+		out.push_back(char(node.Style()));
+		put_u32(out, node.size());
+
+		for (const auto &item : node) {
+			encode(out, item);
+		}
+
+		break;
+
+	case YAML::NodeType::Map:
+		out.push_back(char(Tag::MAP));
+		out.push_back(char(node.Style()));
+		put_u32(out, node.size());
+
+		for (const auto &item : node) {
+			encode(out, item.first);
+			encode(out, item.second);
+		}
+
+		break;
+
+	default:
+		out.push_back(char(Tag::NONE));
+		break;
+	}
+}
+
+static std::string encode(const fs::path &path, const YAML::Node &node)
+{
+	std::string out;
+	put_string(out, path.native());
+	encode(out, node);
+	return out;
+}
+
+/**
+ * Bounds-checked reading of an encoded program, so a corrupt cache file cannot crash us.
+ */
+class Reader
+{
+	const uint8_t *ptr;
+	const uint8_t *end;
+
+	void need(size_t size)
+	{
+		if (size_t(end - ptr) < size) {
+			throw std::runtime_error("Truncated patch cache entry");
+		}
+	}
+
+public:
+	Reader(std::string_view data): ptr(reinterpret_cast<const uint8_t *>(data.data())), end(ptr + data.size()) {}
+
+	uint8_t get_byte()
+	{
+		need(1);
+		return *ptr++;
+	}
+
+	uint32_t get_u32()
+	{
+		uint32_t value;
+		need(sizeof value);
+		std::memcpy(&value, ptr, sizeof value);
+		ptr += sizeof value;
+		return value;
+	}
+
+	std::string_view get_string()
+	{
+		auto size = get_u32();
+		need(size);
+		std::string_view value(reinterpret_cast<const char *>(ptr), size);
+		ptr += size;
+		return value;
+	}
+};
+
+static YAML::Node decode(Reader &in)
+{
+	switch (Tag(in.get_byte())) {
+	case Tag::NONE:
+		return YAML::Node(YAML::NodeType::Null);
+
+	case Tag::SCALAR:
+		return YAML::Node(std::string(in.get_string()));
+
+	case Tag::SEQUENCE: {
+		YAML::Node node(YAML::NodeType::Sequence);
+		node.SetStyle(YAML::EmitterStyle::value(in.get_byte()));
+
+		for (auto count = in.get_u32(); count; --count) {
+			node.push_back(decode(in));
+		}
+
+		return node;
+	}
+
+	case Tag::MAP: {
+		YAML::Node node(YAML::NodeType::Map);
+		node.SetStyle(YAML::EmitterStyle::value(in.get_byte()));
+
+		for (auto count = in.get_u32(); count; --count) {
+			// Keys are unique already, so avoid the lookup done by operator[].
+			auto key = decode(in);
+			node.force_insert(key, decode(in));
+		}
+
+		return node;
+	}
+
+	default:
+		throw std::runtime_error("Invalid patch cache entry");
+	}
+}
+
+PatchCache::Bank::~Bank()
+{
+	unmap();
+}
+
+void PatchCache::Bank::unmap()
+{
+	if (data) {
+		munmap(const_cast<uint8_t *>(data), size);
+	}
+
+	data = nullptr;
+	size = 0;
+	entries.assign(bank_size, {});
+	nodes.assign(bank_size, {});
+}
+
+void PatchCache::Bank::map(const fs::path &path)
+{
+	unmap();
+
+	int fd = open(path.c_str(), O_RDONLY);
+
+	if (fd == -1) {
+		return;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header) + bank_size * sizeof(Entry)) {
+		if (auto ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); ptr != MAP_FAILED) {
+			data = static_cast<const uint8_t *>(ptr);
+			size = st.st_size;
+		}
+	}
+
+	close(fd);
+
+	if (!data) {
+		return;
+	}
+
+	Header header;
+	std::memcpy(&header, data, sizeof header);
+
+	if (std::memcmp(header.magic, magic, sizeof magic) || header.version != version || header.count != bank_size) {
+		unmap();
+		return;
+	}
+
+	std::memcpy(entries.data(), data + sizeof header, bank_size * sizeof(Entry));
+
+	for (auto &entry : entries) {
+		if (entry.offset > size || entry.length > size - entry.offset) {
+			entry = {};
+		}
+	}
+}
+
+std::string_view PatchCache::Bank::find(size_t program, const fs::path &path, int64_t mtime, int64_t size) const
+{
+	auto &entry = entries[program];
+
+	if (!entry.length || entry.mtime != mtime || entry.size != size) {
+		return {};
+	}
+
+	std::string_view blob(reinterpret_cast<const char *>(data + entry.offset), entry.length);
+
+	try {
+		if (Reader(blob).get_string() != path.native()) {
+			return {};
+		}
+	} catch (std::runtime_error &e) {
+		return {};
+	}
+
+	return blob;
+}
+
+std::optional<YAML::Node> PatchCache::Bank::lookup(size_t program, const fs::path &path, int64_t mtime, int64_t size)
+{
+	auto blob = find(program, path, mtime, size);
+
+	if (blob.empty()) {
+		return {};
+	}
+
+	if (nodes[program]) {
+		return nodes[program];
+	}
+
+	try {
+		Reader in(blob);
+		in.get_string();
+		nodes[program] = decode(in);
+		return nodes[program];
+	} catch (std::runtime_error &e) {
+		return {};
+	}
+}
+
+PatchCache::Bank &PatchCache::get_bank(unsigned int bank)
+{
+	auto [it, inserted] = banks.try_emplace(bank);
+
+	if (inserted) {
+		it->second.map(get_bank_cache_path(bank));
+	}
+
+	return it->second;
+}
+
+void PatchCache::write_bank(unsigned int bank, const std::vector<std::string> &blobs, const std::vector<Entry> &entries)
+{
+	auto path = get_bank_cache_path(bank);
+	auto tmp_path = path;
+	tmp_path += ".tmp";
+
+	Header header;
+	std::memcpy(header.magic, magic, sizeof magic);
+	header.version = version;
+	header.count = bank_size;
+
+	std::vector<Entry> index = entries;
+	size_t offset = sizeof header + bank_size * sizeof(Entry);
+
+	for (size_t i = 0; i < bank_size; ++i) {
+		index[i].offset = offset;
+		index[i].length = blobs[i].size();
+		offset += blobs[i].size();
+	}
+
+	std::ofstream file(tmp_path, std::ios::binary);
+	file.write(reinterpret_cast<const char *>(&header), sizeof header);
+	file.write(reinterpret_cast<const char *>(index.data()), bank_size * sizeof(Entry));
+
+	for (auto &blob : blobs) {
+		file.write(blob.data(), blob.size());
+	}
+
+	file.close();
+
+	// Replace the cache atomically, so a concurrent or interrupted write never leaves a broken file behind.
+	std::error_code ec;
+
+	if (file.fail() || (fs::rename(tmp_path, path, ec), ec)) {
+		fmt::print(std::cerr, "Could not write patch cache {}\n", path);
+		fs::remove(tmp_path, ec);
+	}
+
+	banks[bank].map(path);
+}
+
+void PatchCache::build(unsigned int bank)
+{
+	std::lock_guard lock(mutex);
+	auto &cached = get_bank(bank);
+
+	std::vector<std::string> blobs(bank_size);
+	std::vector<Entry> entries(bank_size);
+	bool changed = false;
+
+	for (size_t program = 0; program < bank_size; ++program) {
+		auto path = get_program_path(bank, program);
+		auto &old = cached.entries[program];
+		struct stat st;
+
+		if (stat(path.c_str(), &st) != 0) {
+			changed |= old.length != 0;
+			continue;
+		}
+
+		entries[program].mtime = get_mtime(st);
+		entries[program].size = st.st_size;
+
+		// Only the key is checked here, decoding all entries would take as long as parsing them.
+		if (auto blob = cached.find(program, path, entries[program].mtime, entries[program].size); !blob.empty()) {
+			blobs[program] = blob;
+			continue;
+		}
+
+		// Files that failed to parse keep their key with an empty entry, so they are not parsed again until they change.
+		if (!old.length && old.mtime == entries[program].mtime && old.size == entries[program].size) {
+			continue;
+		}
+
+		changed = true;
+
+		try {
+			blobs[program] = encode(path, YAML::LoadFile(path));
+		} catch (YAML::Exception &e) {
+			// Leave it out of the cache, so load() parses it again and reports the error.
+			// The key is still written, to remember that this version of the file is broken.
+		}
+	}
+
+	if (changed) {
+		write_bank(bank, blobs, entries);
+	}
+}
+
+YAML::Node PatchCache::load(unsigned int bank, uint8_t program)
+{
+	auto path = get_program_path(bank, program);
+	struct stat st;
+
+	if (stat(path.c_str(), &st) != 0) {
+		// Let yaml-cpp generate the appropriate error.
+		return YAML::LoadFile(path);
+	}
+
+	std::lock_guard lock(mutex);
+	auto &cached = get_bank(bank);
+
+	if (auto node = cached.lookup(program, path, get_mtime(st), st.st_size)) {
+		return *node;
+	}
+
+	auto node = YAML::LoadFile(path);
+
+	// Keep the other entries, and replace only this one.
+	std::vector<std::string> blobs(bank_size);
+	auto entries = cached.entries;
+
+	for (size_t i = 0; i < bank_size; ++i) {
+		if (entries[i].length) {
+			blobs[i].assign(reinterpret_cast<const char *>(cached.data + entries[i].offset), entries[i].length);
+		}
+	}
+
+	blobs[program] = encode(path, node);
+	entries[program].mtime = get_mtime(st);
+	entries[program].size = st.st_size;
+	write_bank(bank, blobs, entries);
+	banks[bank].nodes[program] = node;
+
+	return node;
+}
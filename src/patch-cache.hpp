@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+/**
+ * A binary cache of the program files of each bank.
+ *
+ * Parsing YAML is slow, so the parsed node tree of every program in a bank
+ * is stored in a compact binary form in a memory-mapped file in the cache directory.
+ * The YAML files remain the source of truth: each entry is keyed by the path,
+ * modification time and size of the file it was parsed from,
+ * and stale entries are replaced automatically.
+ * Files that could not be parsed are stored as an empty entry with their key,
+ * so they do not cause the bank to be rewritten until they are changed.
+ */
+class PatchCache
+{
+	static const size_t bank_size = 128;
+
+	struct Entry {
+		int64_t mtime;
+		int64_t size;
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct Bank {
+		const uint8_t *data{};
+		size_t size{};
+		std::vector<Entry> entries;
+
+		// Decoded entries, shared by everyone who loads the same program.
+		std::vector<std::optional<YAML::Node>> nodes;
+
+		Bank() = default;
+		~Bank();
+
+		Bank(const Bank &other) = delete;
+		Bank &operator=(const Bank &other) = delete;
+
+		void map(const std::filesystem::path &path);
+		void unmap();
+		std::string_view find(size_t program, const std::filesystem::path &path, int64_t mtime, int64_t size) const;
+		std::optional<YAML::Node> lookup(size_t program, const std::filesystem::path &path, int64_t mtime, int64_t size);
+	};
+
+	std::map<unsigned int, Bank> banks;
+	std::mutex mutex;
+
+	Bank &get_bank(unsigned int bank);
+	void write_bank(unsigned int bank, const std::vector<std::string> &blobs, const std::vector<Entry> &entries);
+
+public:
+	/**
+	 * Bring the cache of a whole bank up to date.
+	 *
+	 * Programs that could not be parsed are skipped,
+	 * the error is reported when they are actually loaded.
+	 */
+	void build(unsigned int bank);
+
+	/**
+	 * Get the parsed contents of a program file.
+	 *
+	 * This returns the cached node tree if it is still valid,
+	 * otherwise the file is parsed and the cache is updated.
+	 * Loading the same program again returns the same node tree,
+	 * so callers must not modify it, not even by using the non-const operator[].
+	 *
+	 * @param bank     The bank number.
+	 * @param program  The MIDI program number.
+	 * @return         The contents of the program file.
+	 * @throws         YAML::Exception if the file could not be loaded.
+	 */
+	YAML::Node load(unsigned int bank, uint8_t program);
+};
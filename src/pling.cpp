@@ -2,25 +2,44 @@
 
 #include "pling.hpp"
 
-#include <chrono>
+#include <algorithm>
+#include <cstring>
 #include <fftw3.h>
 #include <filesystem>
 #include <fmt/ostream.h>
-#include <glm/glm.hpp>
 #include <iostream>
+#include <numeric>
 #include <SDL2/SDL.h>
 #include <set>
+#include <thread>
 
+#include "alsa-audio.hpp"
+#include "benchmark.hpp"
 #include "config.hpp"
+#ifdef HAVE_JACK
+#include "jack-audio.hpp"
+#endif
 #include "midi.hpp"
+#include "offline-render.hpp"
 #include "program-manager.hpp"
+#include "render-monitor.hpp"
+#include "sample-format.hpp"
 #include "ui.hpp"
 #include "state.hpp"
+#include "utils.hpp"
+#include "voice-governor.hpp"
 #include "widgets/oscilloscope.hpp"
 #include "widgets/spectrum.hpp"
+#include "worker-pool.hpp"
 
 static RingBuffer ringbuffer{16384};
+static bool adaptive_polyphony = true;
+static SampleFormat output_format = SampleFormat::F32;
+static unsigned int output_channels = 2;
 Program::Manager programs;
+WorkerPool worker_pool;
+RenderMonitor render_monitor;
+VoiceGovernor voice_governor;
 Config config;
 float sample_rate = 48000;
 
@@ -29,18 +48,33 @@ thread_local std::default_random_engine random_engine(random_device());
 
 State state;
 MIDI::Manager MIDI::manager(programs);
+static AlsaAudio alsa_audio;
+static SDL_AudioDeviceID sdl_audio_device;
+#ifdef HAVE_JACK
+static JackAudio jack_audio;
+#endif
+static size_t audio_period_size = chunk_size;
+
+// Holds the part of the last rendered chunk that did not fit in the previous SDL callback.
+static std::vector<uint8_t> adapter_buffer;
+static size_t adapter_position;
+
+static size_t get_render_threads()
+{
+	int max_threads = std::max(1u, std::thread::hardware_concurrency());
+	return std::clamp(config["render_threads"].as<int>(1), 1, max_threads);
+}
 
-static void audio_callback(void *userdata, uint8_t *stream, int len)
+static void render_audio(uint8_t *stream)
 {
 	static Chunk chunk;
+	auto begin = RenderMonitor::now();
 
 	/* Render samples from active programs */
 	programs.render(chunk);
 
 	/* Add delay effect */
-	const int nsamples = len / 4;
-
-	for (int i = 0; i < nsamples; ++i) {
+	for (size_t i = 0; i < chunk_size; ++i) {
 		chunk.samples[i] += ringbuffer[i - 10000] * 0.25;
 		chunk.samples[i] += ringbuffer[i - 10002] * -0.25;
 	}
@@ -48,92 +82,198 @@ static void audio_callback(void *userdata, uint8_t *stream, int len)
 	/* Add the samples to the oscilloscope */
 	ringbuffer.add(chunk, programs.get_zero_crossing(-384), programs.get_base_frequency());
 
-	/* Convert to 16-bit signed stereo */
-	int16_t *data = (int16_t *)stream;
+	/* Convert to the device's format */
 	float amplitude = state.get_master_volume() * 0.25f; // leave ~12 dB headroom
+	convert_chunk(chunk, amplitude, output_format, output_channels, stream);
 
-	for (int i = 0; i < nsamples; i++) {
-		*data++ = glm::clamp(chunk.samples[i] * amplitude, -1.f, 1.f) * 32767;
-		*data++ = glm::clamp(chunk.samples[i] * amplitude, -1.f, 1.f) * 32767;
+	auto load = render_monitor.record(begin);
+
+	if (adaptive_polyphony) {
+		voice_governor.update(load);
 	}
 }
 
-static void setup_audio()
+static void audio_callback(void *userdata, uint8_t *stream, int len)
+{
+	/* The device period does not have to be a multiple of the chunk size.
+	 * Whole chunks are rendered straight into the stream, and the remainder of a chunk is kept for the next callback. */
+	const size_t chunk_bytes = adapter_buffer.size();
+	size_t remaining = len;
+
+	while (remaining) {
+		if (adapter_position == chunk_bytes) {
+			if (remaining >= chunk_bytes) {
+				render_audio(stream);
+				stream += chunk_bytes;
+				remaining -= chunk_bytes;
+				continue;
+			}
+
+			render_audio(adapter_buffer.data());
+			adapter_position = 0;
+		}
+
+		size_t n = std::min(chunk_bytes - adapter_position, remaining);
+		memcpy(stream, adapter_buffer.data() + adapter_position, n);
+		adapter_position += n;
+		stream += n;
+		remaining -= n;
+	}
+}
+
+static void open_sdl_audio()
 {
 	SDL_AudioSpec want{}, have{};
 
 	want.freq = config["sample_rate"].as<int>(48000);
-	want.format = AUDIO_S16;
+	want.format = AUDIO_F32SYS;
 	want.channels = 2;
-	want.samples = chunk_size;
+	want.samples = config["audio_period_size"].as<unsigned int>(chunk_size);
 	want.callback = audio_callback;
 
+	// Prefer whatever the device uses natively, so SDL does not have to convert it again.
+	int allowed_changes = SDL_AUDIO_ALLOW_FORMAT_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE;
 	auto name = config["audio_device"].as<std::string>("");
+	const char *device = name.c_str();
 
-	SDL_AudioDeviceID dev = SDL_OpenAudioDevice(name.c_str(), 0, &want, &have, 0);
+	SDL_AudioDeviceID dev = SDL_OpenAudioDevice(device, 0, &want, &have, allowed_changes);
 
 	if (!dev) {
 		fmt::print(std::cerr, "Could not open {}\n", name);
-		dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+		device = NULL;
+		dev = SDL_OpenAudioDevice(device, 0, &want, &have, allowed_changes);
 	}
 
 	if (!dev) {
 		throw std::runtime_error(SDL_GetError());
 	}
 
-	if (have.samples != chunk_size) {
-		throw std::runtime_error("Could not get requested audio chunk size");
+	switch (have.format) {
+	case AUDIO_F32SYS:
+		output_format = SampleFormat::F32;
+		break;
+	case AUDIO_S32SYS:
+		output_format = SampleFormat::S32;
+		break;
+	case AUDIO_S16SYS:
+		output_format = SampleFormat::S16;
+		break;
+	default:
+		// Let SDL convert from float to anything more exotic.
+		output_format = SampleFormat::F32;
+		SDL_CloseAudioDevice(dev);
+		dev = SDL_OpenAudioDevice(device, 0, &want, &have, SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+
+		if (!dev) {
+			throw std::runtime_error(SDL_GetError());
+		}
 	}
 
+	output_channels = have.channels;
+	adapter_buffer.resize(chunk_size * output_channels * get_sample_size(output_format));
+	adapter_position = adapter_buffer.size();
+
+	audio_period_size = have.samples;
 	sample_rate = have.freq;
-	std::cerr << sample_rate << "\n";
+	sdl_audio_device = dev;
 
-	SDL_PauseAudioDevice(dev, 0);
+	// At worst, all but the greatest common divisor of the period and chunk sizes is rendered ahead.
+	if (auto latency = chunk_size - std::gcd<size_t>(audio_period_size, chunk_size)) {
+		fmt::print(std::cerr, "Audio period size {} is not a multiple of {}, adding up to {:.2f} ms latency\n",
+		           audio_period_size, chunk_size, latency * 1e3 / sample_rate);
+	}
 }
 
-static void benchmark()
+static void open_alsa_audio()
 {
-	static Chunk chunk;
+	alsa_audio.open(config["audio_device"].as<std::string>("default"),
+	                config["sample_rate"].as<unsigned int>(48000),
+	                config["audio_period_size"].as<unsigned int>(chunk_size),
+	                config["audio_periods"].as<unsigned int>(2));
+
+	output_format = alsa_audio.get_format();
+	output_channels = alsa_audio.get_channels();
+	sample_rate = alsa_audio.get_rate();
+	audio_period_size = alsa_audio.get_period_size();
+	fmt::print(std::cerr, "ALSA period size {}, buffer size {}\n", alsa_audio.get_period_size(), alsa_audio.get_buffer_size());
+}
 
-	std::shared_ptr<Program> program;
-	programs.change(program, 5);
-	programs.activate(program);
+#ifdef HAVE_JACK
+static void open_jack_audio()
+{
+	jack_audio.open(config["jack_client_name"].as<std::string>("pling"));
 
-	// Warm-up
-	program->release_all();
+	// JACK ports carry mono float samples, the same chunk is copied to both outputs.
+	output_format = SampleFormat::F32;
+	output_channels = 1;
+	sample_rate = jack_audio.get_rate();
+	audio_period_size = jack_audio.get_buffer_size();
+}
+#endif
 
-	for (size_t i = 0; i < 32; ++i) {
-		program->note_on(48 + i, 80 + i);
+static void setup_audio()
+{
+	auto backend = config["audio_backend"].as<std::string>("sdl");
+
+	if (backend == "alsa") {
+		open_alsa_audio();
+#ifdef HAVE_JACK
+	} else if (backend == "jack") {
+		open_jack_audio();
+#endif
+	} else {
+		if (backend != "sdl") {
+			fmt::print(std::cerr, "Unknown audio backend {}, using SDL\n", backend);
+			backend = "sdl";
+		}
+
+		open_sdl_audio();
 	}
 
-	for (size_t i = 0; i < 100; ++i) {
-		programs.render(chunk);
+	fmt::print(std::cerr, "Audio output: {} Hz, {} channels, {}\n", sample_rate, output_channels, get_name(output_format));
+	render_monitor.start(sample_rate, audio_period_size);
+	adaptive_polyphony = config["adaptive_polyphony"].as<bool>(true);
+
+	if (backend == "alsa") {
+		// A priority commonly used for audio threads, 0 disables real-time scheduling.
+		alsa_audio.start(render_audio, config["audio_priority"].as<int>(70));
+#ifdef HAVE_JACK
+	} else if (backend == "jack") {
+		jack_audio.start(render_audio, config["jack_autoconnect"].as<bool>(true));
+#endif
+	} else {
+		SDL_PauseAudioDevice(sdl_audio_device, 0);
 	}
+}
 
-	// Measurement
-	program->release_all();
-
-	for (size_t i = 0; i < 32; ++i) {
-		program->note_on(48 + i, 80 + i);
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && std::string(argv[1]) == "benchmark") {
+		return benchmark(argc - 2, argv + 2);
 	}
 
-	using clock = std::chrono::steady_clock;
-	auto begin = clock::now();
+	if (argc > 1 && std::string(argv[1]) == "render") {
+		if (argc != 4) {
+			fmt::print(std::cerr, "Usage: {} render <input.mid> <output.wav>\n", argv[0]);
+			return 1;
+		}
 
-	for (size_t i = 0; i < 10000; ++i) {
-		programs.render(chunk);
-	}
+		// No audio or video is needed, only the configuration.
+		auto pref_path = SDL_GetPrefPath(NULL, "pling");
+		config.init(pref_path);
+		SDL_free(pref_path);
 
-	auto end = clock::now();
-	auto diff = end - begin;
+		sample_rate = config["sample_rate"].as<int>(48000);
+		worker_pool.start(get_render_threads());
+		programs.preload();
 
-	std::cout << "Rendered 1000 chunks in " << std::chrono::duration_cast<std::chrono::milliseconds>(diff).count() << "ms\n";
-}
+		try {
+			render_midi_file(argv[2], argv[3]);
+		} catch (std::runtime_error &e) {
+			fmt::print(std::cerr, "{}\n", e.what());
+			return 1;
+		}
 
-int main(int argc, char *argv[])
-{
-	if (argc > 1 && std::string(argv[1]) == "benchmark") {
-		benchmark();
 		return 0;
 	}
 
@@ -142,6 +282,8 @@ int main(int argc, char *argv[])
 	config.init(pref_path);
 	SDL_free(pref_path);
 
+	worker_pool.start(get_render_threads());
+	programs.preload();
 	setup_audio();
 	MIDI::manager.start();
 
@@ -149,6 +291,14 @@ int main(int argc, char *argv[])
 	UI ui(ringbuffer);
 
 	ui.run();
+	alsa_audio.stop();
+#ifdef HAVE_JACK
+	jack_audio.stop();
+#endif
+
+	if (auto filename = config["render_times_file"].as<std::string>(""); !filename.empty()) {
+		render_monitor.dump(filename);
+	}
 
 	fftwf_export_wisdom_to_filename(config.get_cache_path("fft.wisdom").c_str());
 	SDL_Quit();
@@ -14,7 +14,10 @@
 #include "config.hpp"
 
 extern float sample_rate;
-static const size_t chunk_size = 128;
+
+// The number of frames rendered at once, chosen at build time with meson configure -Dchunk_size=...
+static const size_t chunk_size = CHUNK_SIZE;
+static_assert(chunk_size >= 16 && (chunk_size & (chunk_size - 1)) == 0, "chunk_size must be a power of two of at least 16");
 
 extern Config config;
 
@@ -2,6 +2,8 @@
 
 #include "program-manager.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <fmt/ostream.h>
 #include <iostream>
@@ -10,44 +12,248 @@
 
 #include "config.hpp"
 #include "programs/simple.hpp"
+#include "render-monitor.hpp"
+#include "worker-pool.hpp"
+
+Program::Manager::Manager()
+{
+	active_programs.reserve(max_active_programs);
+	render_slots.reserve(max_active_programs);
+
+	render_task = [this](size_t i) {
+		auto &slot = render_slots[i];
+		slot.chunk.clear();
+		auto begin = RenderMonitor::now();
+		slot.active = render_program(*slot.program, slot.chunk);
+
+		// Each program is rendered by only one thread at a time, so no atomic read-modify-write is needed.
+		auto &program = *slot.program;
+		float load = render_monitor.get_load(begin);
+		program.render_load.store(program.get_render_load() + (load - program.get_render_load()) * 0.05f, std::memory_order_relaxed);
+
+		if (load > program.get_peak_render_load()) {
+			program.peak_render_load.store(load, std::memory_order_relaxed);
+		}
+	};
+
+	loader = std::thread(&Manager::run_loader, this);
+}
+
+Program::Manager::~Manager()
+{
+	{
+		std::lock_guard lock(load_mutex);
+		quit_loader = true;
+	}
+
+	load_cond.notify_one();
+	loader.join();
+}
+
+/**
+ * Get the number of voices for programs that do not specify it themselves.
+ *
+ * The global configuration can set either a single number for all engines, or a number per engine.
+ */
+static uint32_t get_default_polyphony(const std::string &engine_name)
+{
+	const YAML::Node polyphony = config["polyphony"];
+
+	if (polyphony.IsMap()) {
+		return polyphony[engine_name].as<uint32_t>(Program::default_polyphony);
+	}
+
+	return polyphony.as<uint32_t>(Program::default_polyphony);
+}
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Program::Manager::make_active(const std::shared_ptr<Program> &program)
+{
+	// The audio thread clears the flag when the program has become silent.
+	if (program->active.exchange(true)) {
+		return;
+	}
+
+	program->prepare();
+
+	if (!activations.push(program.get())) {
+		program->active = false;
+		fmt::print(std::cerr, "Too many active programs\n");
+		return;
+	}
+
+	owned_programs.push_back(program);
+}
+
+void Program::Manager::reclaim()
+{
+	// Destroy programs here instead of in the audio thread, if this was the last reference to them.
+	while (auto program = retirements.front()) {
+		auto it = std::find_if(owned_programs.begin(), owned_programs.end(), [&](auto & owned) {
+			return owned.get() == *program;
+		});
+
+		std::swap(*it, owned_programs.back());
+		owned_programs.pop_back();
+		retirements.pop();
+	}
+}
 
 void Program::Manager::activate(std::shared_ptr<Program> &program)
 {
-	last_activated_program = program;
+	std::lock_guard lock(queue_mutex);
+	auto current = std::atomic_load(&program);
+	std::atomic_store(&last_activated_program, current);
+	reclaim();
+	make_active(current);
+}
 
-	std::lock_guard lock(active_program_mutex);
+void Program::Manager::queue(std::shared_ptr<Program> &program, Program::Event event)
+{
+	// Look up the program while holding the lock, so the event cannot end up
+	// in a program that was just replaced by the loader and has had all its notes released.
+	std::lock_guard lock(queue_mutex);
+	event.frame = get_current_frame();
+	queue_locked(std::atomic_load(&program), event);
+}
 
-	if (program->active) {
+void Program::Manager::queue(std::shared_ptr<Program> &program, Program::Event event, int64_t frame)
+{
+	std::lock_guard lock(queue_mutex);
+	event.frame = frame;
+	queue_locked(std::atomic_load(&program), event);
+}
+
+int64_t Program::Manager::get_current_frame() const
+{
+	return (now_ns() - epoch.load(std::memory_order_relaxed)) * 1e-9 * sample_rate;
+}
+
+void Program::Manager::queue_locked(const std::shared_ptr<Program> &program, const Program::Event &event)
+{
+	reclaim();
+
+	if (!program->events.push(event)) {
+		fmt::print(std::cerr, "Event queue full, dropping event\n");
 		return;
 	}
 
-	program->active = true;
-	active_programs.push_back(program);
+	// The event must be queued before checking whether the program is active,
+	// otherwise the audio thread could retire it without having seen the event.
+	make_active(program);
 }
 
 void Program::Manager::change(std::shared_ptr<Program> &program, uint8_t MIDI_program, uint8_t bank_lsb, uint8_t bank_msb)
 {
-	if (program) {
-		if (program->MIDI_program == MIDI_program && program->bank_lsb == bank_lsb && program->bank_msb == bank_msb) {
+	auto current = std::atomic_load(&program);
+
+	if (!current) {
+		// Nothing can be playing yet, so there is no need to load it in the background.
+		current = load(MIDI_program, bank_lsb, bank_msb);
+		std::atomic_store(&program, current);
+		select(current);
+		return;
+	}
+
+	{
+		std::lock_guard lock(load_mutex);
+
+		// Only the last of several quick changes for the same slot matters, so merge it with a pending request.
+		for (auto &request : load_requests) {
+			if (request.slot == &program) {
+				request.MIDI_program = MIDI_program;
+				request.bank_lsb = bank_lsb;
+				request.bank_msb = bank_msb;
+				request.time = std::chrono::steady_clock::now();
+				return;
+			}
+		}
+
+		// The program in the slot is only what it will end up with if nothing is being loaded for it.
+		if (loading_slot != &program && current->is_same(MIDI_program, bank_lsb, bank_msb)) {
 			return;
 		}
 
-		program->release_all();
+		load_requests.push_back({&program, MIDI_program, bank_lsb, bank_msb, std::chrono::steady_clock::now()});
 	}
 
+	load_cond.notify_one();
+}
+
+void Program::Manager::run_loader()
+{
+	std::unique_lock lock(load_mutex);
+
+	while (true) {
+		load_cond.wait(lock, [&] {
+			return quit_loader || !load_requests.empty();
+		});
+
+		if (quit_loader) {
+			break;
+		}
+
+		auto request = load_requests.front();
+		load_requests.pop_front();
+
+		if (std::atomic_load(request.slot)->is_same(request.MIDI_program, request.bank_lsb, request.bank_msb)) {
+			continue;
+		}
+
+		loading_slot = request.slot;
+		lock.unlock();
+
+		// Parse and construct the new program completely before anyone can see it.
+		auto program = load(request.MIDI_program, request.bank_lsb, request.bank_msb);
+		std::shared_ptr<Program> old;
+
+		{
+			// Swap it in atomically with respect to queue(), so no notes can get stuck in the old program.
+			std::lock_guard queue_lock(queue_mutex);
+			old = std::atomic_exchange(request.slot, program);
+
+			// A program that is not active is silent, and may never have been prepared, so don't activate it just to release it.
+			if (old->active) {
+				queue_locked(old, {Program::Event::Type::RELEASE_ALL, 0, 0, 0, get_current_frame()});
+			}
+		}
+
+		select(program);
+		load_latency = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - request.time).count();
+
+		// If the old program is silent already, it is destroyed here.
+		old.reset();
+
+		// Catch up with any other changes to this bank while we are idle anyway.
+		preload(request.bank_lsb, request.bank_msb);
+		lock.lock();
+		loading_slot = nullptr;
+	}
+}
+
+std::shared_ptr<Program> Program::Manager::load(uint8_t MIDI_program, uint8_t bank_lsb, uint8_t bank_msb)
+{
+	std::shared_ptr<Program> program;
 	std::filesystem::path filename = "programs";
 	filename /= "bank-" + std::to_string(bank_lsb << 7 | bank_msb);
 	filename /= std::to_string(MIDI_program) + ".yaml";
 	auto path = config.get_load_path(filename);
+	std::lock_guard lock(patch_mutex);
 
 	try {
-		auto program_config = YAML::LoadFile(path);
+		// Shared with other programs loaded from the same file, so only use const access.
+		const YAML::Node program_config = patch_cache.load(bank_lsb << 7 | bank_msb, MIDI_program);
 
 		auto engine_name = program_config["engine"].as<std::string>();
 
 		if (const auto &it = engines.find(engine_name); it != engines.end()) {
 			program = it->second();
 			program->name = program_config["name"].as<std::string>();
+			program->polyphony = program_config["polyphony"].as<uint32_t>(get_default_polyphony(engine_name));
 			program->load(program_config["parameters"]);
 		} else {
 			program = std::make_shared<Program>();
@@ -63,13 +269,51 @@ void Program::Manager::change(std::shared_ptr<Program> &program, uint8_t MIDI_pr
 	program->bank_lsb = bank_lsb;
 	program->bank_msb = bank_msb;
 
-	selected_program = program;
-	last_activated_program = program;
+	return program;
+}
+
+std::shared_ptr<Program> Program::Manager::create(const std::string &engine_name) const
+{
+	if (const auto &it = engines.find(engine_name); it != engines.end()) {
+		auto program = it->second();
+		program->polyphony = get_default_polyphony(engine_name);
+		return program;
+	} else {
+		return nullptr;
+	}
+}
+
+std::vector<std::string> Program::Manager::get_engine_names() const
+{
+	std::vector<std::string> names;
+
+	for (auto &[name, factory] : engines) {
+		names.push_back(name);
+	}
+
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+void Program::Manager::preload(uint8_t bank_lsb, uint8_t bank_msb)
+{
+	patch_cache.build(bank_lsb << 7 | bank_msb);
+}
+
+void Program::Manager::select(const std::shared_ptr<Program> &program)
+{
+	std::atomic_store(&selected_program, program);
+	std::atomic_store(&last_activated_program, program);
 }
 
 void Program::Manager::save_selected_program()
 {
-	auto program = selected_program;
+	auto program = std::atomic_load(&selected_program);
+
+	if (!program) {
+		return;
+	}
+
 	std::filesystem::path filename = "programs";
 	filename /= "bank-" + std::to_string(program->bank_lsb << 7 | program->bank_msb);
 	filename /= std::to_string(program->MIDI_program) + ".yaml";
@@ -78,6 +322,11 @@ void Program::Manager::save_selected_program()
 	YAML::Node program_config;
 	program_config["name"] = program->name;
 	program_config["engine"] = program->get_engine_name();
+
+	if (program->polyphony != get_default_polyphony(program->get_engine_name())) {
+		program_config["polyphony"] = program->polyphony;
+	}
+
 	program_config["parameters"] = program->save();
 
 	std::ofstream file(path);
@@ -93,8 +342,8 @@ void Program::Manager::save_selected_program()
 
 float Program::Manager::get_zero_crossing(float offset) const
 {
-	if (last_activated_program) {
-		return last_activated_program->get_zero_crossing(offset);
+	if (auto program = std::atomic_load(&last_activated_program)) {
+		return program->get_zero_crossing(offset);
 	} else {
 		return offset;
 	}
@@ -102,26 +351,96 @@ float Program::Manager::get_zero_crossing(float offset) const
 
 float Program::Manager::get_base_frequency() const
 {
-	if (last_activated_program) {
-		return last_activated_program->get_base_frequency();
+	if (auto program = std::atomic_load(&last_activated_program)) {
+		return program->get_base_frequency();
 	} else
 		return {};
 }
 
-void Program::Manager::render(Chunk &chunk)
+bool Program::Manager::render_program(Program &program, Chunk &chunk)
+{
+	/* Events are applied one chunk later than the frame they were received at,
+	 * so they all get a constant latency instead of jitter depending on when they arrived.
+	 * The render is split at each event, so it takes effect at the right sample.
+	 * Events for a later chunk stay queued, only late events are moved up to the current sample. */
+	size_t begin = 0;
+
+	while (auto event = program.events.front()) {
+		int64_t target = event->frame + chunk_size - frame;
+
+		if (target >= int64_t(chunk_size)) {
+			break;
+		}
+
+		size_t offset = std::max<int64_t>(target, begin);
+
+		if (offset > begin) {
+			program.render(chunk, begin, offset);
+			begin = offset;
+		}
+
+		program.apply(*event);
+		program.events.pop();
+	}
+
+	return program.render(chunk, begin, chunk_size);
+}
+
+bool Program::Manager::render(Chunk &chunk)
 {
 	chunk.clear();
 
-	std::lock_guard lock(active_program_mutex);
+	// Let the MIDI thread convert the time events arrive at into frame numbers.
+	epoch.store(now_ns() - int64_t(frame * 1e9 / sample_rate), std::memory_order_relaxed);
 
-	for (auto it = active_programs.begin(); it != active_programs.end();) {
-		auto program = it->get();
+	while (active_programs.size() < max_active_programs) {
+		auto program = activations.front();
 
-		if (!program->render(chunk)) {
-			program->active = false;
-			it = active_programs.erase(it);
-		} else {
-			++it;
+		if (!program) {
+			break;
+		}
+
+		active_programs.push_back(*program);
+		activations.pop();
+	}
+
+	// Render each program into its own chunk, in parallel if there are worker threads.
+	render_slots.resize(active_programs.size());
+
+	for (size_t i = 0; i < active_programs.size(); ++i) {
+		render_slots[i].program = active_programs[i];
+	}
+
+	worker_pool.run(render_slots.size(), render_task);
+
+	// Sum the results in a fixed order, so the output does not depend on the number of threads.
+	for (auto &slot : render_slots) {
+		for (size_t i = 0; i < chunk_size; ++i) {
+			chunk.samples[i] += slot.chunk.samples[i];
+		}
+	}
+
+	/* Retire programs that became inactive. If an event was queued in the mean time,
+	 * whichever thread sets the active flag again gets to keep the program in the list. */
+	for (size_t i = render_slots.size(); i--;) {
+		auto program = render_slots[i].program;
+
+		if (render_slots[i].active || retirements.full()) {
+			continue;
+		}
+
+		// This synchronizes with make_active(), so any event queued before it is visible here.
+		program->active.exchange(false);
+
+		if (program->events.front() && !program->active.exchange(true)) {
+			continue;
 		}
+
+		retirements.push(program);
+		active_programs.erase(active_programs.begin() + i);
 	}
+
+	frame += chunk_size;
+
+	return !active_programs.empty();
 }
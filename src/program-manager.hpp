@@ -3,23 +3,88 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "patch-cache.hpp"
 #include "program.hpp"
 
 class Program::Manager
 {
-	// Added to by MIDI thread, deleted from by audio thread.
 	using EngineFactory = std::function<std::shared_ptr<Program>()>;
-	std::deque<std::shared_ptr<Program>> active_programs;
-	std::mutex active_program_mutex;
 
+	/* The audio thread must never block or free memory, so it only sees raw pointers to active programs.
+	 * Programs are handed to it via the activation queue, and handed back via the retirement queue
+	 * once they are silent. Until then, owned_programs keeps them alive. */
+	static const size_t max_active_programs = 256;
+	SPSCQueue<Program *, max_active_programs> activations;
+	SPSCQueue<Program *, max_active_programs> retirements;
+	std::vector<std::shared_ptr<Program>> owned_programs;
+
+	// Only used by the audio thread.
+	std::vector<Program *> active_programs;
+
+	// Used by the audio thread to render each active program into its own chunk.
+	struct RenderSlot {
+		Program *program;
+		Chunk chunk;
+		bool active;
+	};
+
+	std::vector<RenderSlot> render_slots;
+	std::function<void(size_t)> render_task;
+
+	// The frame number of the start of the chunk being rendered, only used by the audio thread.
+	int64_t frame{};
+
+	// The time in nanoseconds of frame 0, written by the audio thread, read by the MIDI thread.
+	std::atomic<int64_t> epoch{};
+
+	// The queues only support one producer, but both the MIDI thread and the UI can queue events.
+	std::mutex queue_mutex;
+
+	// Program changes are loaded by a background thread, so they don't stall MIDI input.
+	struct LoadRequest {
+		std::shared_ptr<Program> *slot;
+		uint8_t MIDI_program;
+		uint8_t bank_lsb;
+		uint8_t bank_msb;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	std::deque<LoadRequest> load_requests;
+	std::shared_ptr<Program> *loading_slot{};
+	std::mutex load_mutex;
+	std::condition_variable load_cond;
+	bool quit_loader{};
+	std::thread loader;
+	std::atomic<float> load_latency{};
+
+	PatchCache patch_cache;
+
+	// Programs loaded from the same file share the parsed patch, which yaml-cpp does not allow reading concurrently.
+	std::mutex patch_mutex;
+
+	void run_loader();
+	std::shared_ptr<Program> load(uint8_t MIDI_program, uint8_t bank_lsb, uint8_t bank_msb);
+	void select(const std::shared_ptr<Program> &program);
+
+	void make_active(const std::shared_ptr<Program> &program);
+	void queue_locked(const std::shared_ptr<Program> &program, const Program::Event &event);
+	int64_t get_current_frame() const;
+	void reclaim();
+	bool render_program(Program &program, Chunk &chunk);
+
+	// Replaced by the loader thread and read by all others, so only access them atomically.
 	std::shared_ptr<Program> selected_program;
 	std::shared_ptr<Program> last_activated_program;
 
@@ -28,6 +93,9 @@ class Program::Manager
 public:
 	class Registration {};
 
+	Manager();
+	~Manager();
+
 	/**
 	 * Activate a Program for a given MIDI program.
 	 *
@@ -35,23 +103,88 @@ public:
 	 */
 	void activate(std::shared_ptr<Program> &program);
 
+	/**
+	 * Queue a MIDI event for a Program.
+	 *
+	 * The event is timestamped and applied by the audio thread at the corresponding sample
+	 * of the next chunk to be rendered. This also activates the program if necessary.
+	 *
+	 * @param program  The slot holding the program, which might be replaced by change() at any time.
+	 * @param event    The event to queue.
+	 */
+	void queue(std::shared_ptr<Program> &program, Program::Event event);
+
+	/**
+	 * Queue a MIDI event for a Program, to be applied at a given frame.
+	 *
+	 * This is used for offline rendering and JACK MIDI, where events come with their own timestamps.
+	 * Like events queued in real time, it takes effect chunk_size frames after the given frame.
+	 */
+	void queue(std::shared_ptr<Program> &program, Program::Event event, int64_t frame);
+
+	/**
+	 * Get the frame number of the start of the next chunk to be rendered. Only the audio thread may call this.
+	 */
+	int64_t get_render_frame() const
+	{
+		return frame;
+	}
+
+	/**
+	 * Change the program in a slot.
+	 *
+	 * If the slot is empty, the new program is loaded immediately.
+	 * Otherwise, it is loaded in the background, and the old program
+	 * keeps sounding until the new one replaces it and its voices are released.
+	 */
 	void change(std::shared_ptr<Program> &program, uint8_t MIDI_program, uint8_t bank_lsb = 0, uint8_t bank_msb = 0);
+
+	/**
+	 * Bring the patch cache of a bank up to date, so program changes within it don't have to parse YAML.
+	 */
+	void preload(uint8_t bank_lsb = 0, uint8_t bank_msb = 0);
 	void save_selected_program();
 
 	float get_zero_crossing(float offset) const;
 	float get_base_frequency() const;
-	void render(Chunk &chunk);
+
+	/**
+	 * Render the next chunk of all active programs. Only the audio thread may call this.
+	 *
+	 * @return True if any program is still active.
+	 */
+	bool render(Chunk &chunk);
 
 	std::shared_ptr<Program> get_selected_program()
 	{
-		return selected_program;
+		return std::atomic_load(&selected_program);
 	}
 
 	std::shared_ptr<Program> get_last_activated_program()
 	{
-		return last_activated_program;
+		return std::atomic_load(&last_activated_program);
 	}
 
+	/**
+	 * Get the time in milliseconds between the last program change and the new program becoming playable.
+	 */
+	float get_load_latency() const
+	{
+		return load_latency;
+	}
+
+	/**
+	 * Create a new Program using the given engine, with its default parameters.
+	 *
+	 * @return The new program, or nullptr if there is no engine with that name.
+	 */
+	std::shared_ptr<Program> create(const std::string &engine_name) const;
+
+	/**
+	 * Get the names of all registered engines, in alphabetical order.
+	 */
+	std::vector<std::string> get_engine_names() const;
+
 	Registration register_engine(const std::string &name, EngineFactory factory)
 	{
 		engines[name] = factory;
@@ -4,25 +4,108 @@
 
 #include "controller.hpp"
 #include "pling.hpp"
+#include "spsc-queue.hpp"
 
 #include <yaml-cpp/yaml.h>
 
 class Program
 {
 protected:
-	bool active{};
+	std::atomic<bool> active{};
 	uint8_t MIDI_program;
 	uint8_t bank_lsb;
 	uint8_t bank_msb;
 
 	std::string name;
 
+	// The maximum number of voices, from the program or the global configuration.
+	uint32_t polyphony{default_polyphony};
+
 public:
 	class Manager;
 
+	static constexpr uint32_t default_polyphony = 32;
+
+	/**
+	 * A MIDI event, to be applied by the audio thread at a given frame.
+	 */
+	struct Event {
+		enum class Type: uint8_t {
+			NOTE_ON,
+			NOTE_OFF,
+			POLY_PRESSURE,
+			CHANNEL_PRESSURE,
+			PITCH_BEND,
+			MODULATION,
+			SUSTAIN,
+			RELEASE_ALL,
+		} type;
+		uint8_t key;
+		uint8_t value;
+		int16_t bend;
+		int64_t frame;
+	};
+
+protected:
+	// Written to by Program::Manager::queue(), read from by the audio thread.
+	SPSCQueue<Event, 256> events;
+
+	// The fraction of the chunk deadline spent rendering this program, written by the audio thread.
+	std::atomic<float> render_load{};
+	std::atomic<float> peak_render_load{};
+
+	void apply(const Event &event)
+	{
+		switch (event.type) {
+		case Event::Type::NOTE_ON:
+			note_on(event.key, event.value);
+			break;
+
+		case Event::Type::NOTE_OFF:
+			note_off(event.key, event.value);
+			break;
+
+		case Event::Type::POLY_PRESSURE:
+			poly_pressure(event.key, event.value);
+			break;
+
+		case Event::Type::CHANNEL_PRESSURE:
+			channel_pressure(event.value);
+			break;
+
+		case Event::Type::PITCH_BEND:
+			pitch_bend(event.bend);
+			break;
+
+		case Event::Type::MODULATION:
+			modulation(event.value);
+			break;
+
+		case Event::Type::SUSTAIN:
+			sustain(event.value);
+			break;
+
+		case Event::Type::RELEASE_ALL:
+			release_all();
+			break;
+		}
+	}
+
+public:
 	virtual ~Program() {};
 
-	virtual bool render(Chunk &chunk)
+	/**
+	 * Render part of a chunk, adding the output to it.
+	 *
+	 * Within one chunk, this is called for consecutive ranges of samples,
+	 * with MIDI events applied between them. The last range always ends at chunk_size.
+	 *
+	 * @param chunk  The chunk to add the output to.
+	 * @param begin  The index of the first sample to render.
+	 * @param end    The index one past the last sample to render.
+	 * @return       True if the program is still producing sound.
+	 */
+	virtual bool render(Chunk &chunk, size_t begin, size_t end)
 	{
 		return false;
 	};
@@ -37,6 +120,15 @@ public:
 		return {};
 	};
 
+	/**
+	 * Allocate the memory needed to play this program.
+	 *
+	 * This is called before the program is activated, but never from the audio thread,
+	 * so programs that are loaded but never played do not have to hold on to memory for their voices.
+	 * The memory is kept until the program is destroyed, it is not freed when the program falls silent.
+	 */
+	virtual void prepare() {};
+
 	virtual void note_on(uint8_t key, uint8_t vel) {};
 	virtual void note_off(uint8_t key, uint8_t vel) {};
 	virtual void pitch_bend(int16_t bend) {};
@@ -81,4 +173,25 @@ public:
 	{
 		return MIDI_program;
 	}
+
+	/**
+	 * Check whether this was loaded from the given MIDI program and bank.
+	 */
+	bool is_same(uint8_t MIDI_program, uint8_t bank_lsb, uint8_t bank_msb) const
+	{
+		return this->MIDI_program == MIDI_program && this->bank_lsb == bank_lsb && this->bank_msb == bank_msb;
+	}
+
+	/**
+	 * Get the average time spent rendering this program, as a fraction of the chunk deadline.
+	 */
+	float get_render_load() const
+	{
+		return render_load.load(std::memory_order_relaxed);
+	}
+
+	float get_peak_render_load() const
+	{
+		return peak_render_load.load(std::memory_order_relaxed);
+	}
 };
@@ -13,9 +13,10 @@
 
 static std::uniform_real_distribution<float> uniform_distribution(-1.0f, 1.0f);
 
-bool KarplusStrong::Voice::render(Chunk &chunk, Parameters &params)
+bool KarplusStrong::Voice::render(Chunk &chunk, size_t begin, size_t end, const Parameters &params)
 {
-	for (auto &sample : chunk.samples) {
+	for (size_t i = begin; i < end; ++i) {
+		auto &sample = chunk.samples[i];
 		float decay_envelope = filter_envelope.update(params.filter_envelope);
 
 		float rp = osc() * buffer.size();
@@ -77,15 +78,16 @@ float KarplusStrong::Voice::get_frequency(const Parameters &params) const
 	return osc.get_frequency(params.bend);
 }
 
-bool KarplusStrong::render(Chunk &chunk)
+void KarplusStrong::prepare()
 {
-	bool active = false;
-
-	for (auto &voice : voices) {
-		active |= voice.render(chunk, params);
-	}
+	voices.allocate(polyphony);
+}
 
-	return active;
+bool KarplusStrong::render(Chunk &chunk, size_t begin, size_t end)
+{
+	return voices.render(chunk, begin, end, [&](Voice & voice, Chunk & voice_chunk) {
+		return voice.render(voice_chunk, begin, end, params);
+	});
 }
 
 float KarplusStrong::get_zero_crossing(float offset) const
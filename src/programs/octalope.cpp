@@ -2,6 +2,7 @@
 
 #include "octalope.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <fmt/format.h>
 #include <fmt/ostream.h>
@@ -12,6 +13,7 @@
 #include "pling.hpp"
 #include "../imgui/imgui.h"
 #include "../program-manager.hpp"
+#include "../simd.hpp"
 #include "utils.hpp"
 
 static float rng(float range)
@@ -77,121 +79,526 @@ void Octalope::Parameters::Filter::set_flags(uint8_t val)
 	update_frequency();
 }
 
-bool Octalope::Voice::render(Chunk &chunk, Parameters &params)
+void Octalope::Routing::compile(const Parameters &params)
 {
-	for (auto &sample : chunk.samples) {
-		float accum{};
+	// Operator 8 is also used as the LFO for pitch, filter and amplitude modulation
+	const float frequency_lfo_depth = params.frequency.lfo_depth + params.frequency.mod_sensitivity * params.modulation;
+	const float filter_lfo_depth = params.filter.lfo_depth + params.modulation * params.filter.mod_sensitivity;
+	float am_levels[8];
+	bool needed[8];
 
-		// Determine the current voice frequency
-		float voice_freq = frequency.base * std::exp2(params.bend * params.frequency.bend_sensitivity / 12.0f) * frequency.envelope.update(params.frequency.envelope, frequency.rate);
+	for (int i = 0; i < 8; ++i) {
+		am_levels[i] = params.ops[i].am_level + params.modulation * params.ops[i].mod_sensitivity;
+		needed[i] = params.ops[i].output_level != 0;
+	}
 
-		if (params.frequency.lfo_depth || params.modulation) {
-			voice_freq *= std::exp2((params.frequency.lfo_depth + params.frequency.mod_sensitivity * params.modulation) / 12.0f * ops[7].value);
-		}
+	needed[7] |= frequency_lfo_depth || filter_lfo_depth;
 
-		// Go backwards through all operators,
-		// since it's more likely that an operator is modulated by a higher number one,
-		// and this way they are more likely to be exactly in sync.
-		for (int i = 8; i--;) {
-			// Update the unmodulated phase of the oscillator
-			float op_freq = params.ops[i].frequency;
+	// Find all operators that modulate audible operators
+	for (bool changed = true; changed;) {
+		changed = false;
 
-			if (!params.ops[i].fixed) {
-				op_freq *= voice_freq;
+		for (int i = 0; i < 8; ++i) {
+			if (!needed[i]) {
+				continue;
 			}
 
-			op_freq += params.ops[i].detune;
-			float sync = ops[i].osc.update_sync(op_freq / sample_rate);
+			for (int j = 0; j < 8; ++j) {
+				if (!needed[j] && (params.ops[i].fm_level[j] || (j == 7 && am_levels[i]))) {
+					needed[j] = true;
+					changed = true;
+				}
+			}
+		}
+	}
 
-			// Determine the amount of phase modulation
-			float pm{};
+	// Sort the operators such that modulators come before the operators they modulate.
+	// Prefer higher numbered operators, which is the most likely order for most algorithms.
+	// If there is a feedback loop, break it at the highest numbered operator.
+	bool done[8] {};
+	count = 0;
+	skipped_count = 0;
+	max_modulators = 0;
+
+	for (int n = 0; n < 8; ++n) {
+		int next = -1;
+
+		for (int i = 8; i--;) {
+			if (!needed[i] || done[i]) {
+				continue;
+			}
+
+			bool ready = true;
 
 			for (int j = 0; j < 8; ++j) {
-				pm += ops[j].value * params.ops[i].fm_level[j];
+				if (j != i && needed[j] && !done[j] && (params.ops[i].fm_level[j] || (j == 7 && am_levels[i]))) {
+					ready = false;
+				}
 			}
 
-			// Get the oscillator's output value
-			float value;
+			if (ready || next < 0) {
+				next = i;
+			}
 
-			switch (params.ops[i].waveform % 8) {
-			case 0:
-				value = ops[i].osc.sine(pm);
+			if (ready) {
 				break;
+			}
+		}
 
-			case 1:
-				value = ops[i].osc.triangle(pm);
-				break;
+		if (next < 0) {
+			break;
+		}
 
-			case 2:
-				value = ops[i].osc.square(pm);
-				break;
+		done[next] = true;
 
-			case 3:
-				value = ops[i].osc.saw(pm);
-				break;
+		auto &step = steps[count++];
+		step.op = next;
+		step.count = 0;
+		step.am_level = am_levels[next];
+		step.output_level = params.ops[next].output_level;
 
-			case 4:
-				value = -ops[i].osc.saw(pm);
-				break;
+		for (int j = 0; j < 8; ++j) {
+			if (params.ops[next].fm_level[j]) {
+				step.modulators[step.count] = j;
+				step.fm_levels[step.count] = params.ops[next].fm_level[j];
+				step.count++;
+			}
+		}
 
-			case 5:
-				value = noise();
-				break;
+		// Pad with unused routings, so the render loop can use a fixed number of modulators
+		for (int j = step.count; j < 8; ++j) {
+			step.modulators[j] = next;
+			step.fm_levels[j] = 0;
+		}
 
-			case 6:
-				value = sample_and_hold((sync + pm) < 0, ops[i].hold);
-				break;
+		max_modulators = std::max<size_t>(max_modulators, step.count);
+	}
 
-			case 7:
-				value = sample_and_hold(sync < 0, ops[i].hold, pm);
-				break;
+	for (int i = 0; i < 8; ++i) {
+		if (!needed[i]) {
+			skipped[skipped_count++] = i;
+		}
+	}
+}
 
-			default:
-				value = 0;
-				break;
-			}
+template<size_t M>
+bool Octalope::Voice::render(Chunk &chunk, size_t begin, size_t end, const Parameters &params, const Routing &routing)
+{
+	// Voices can be rendered in parallel, so use a private copy of the filter parameters.
+	auto svf_params = params.filter.svf;
+
+	// When oversampling, the chunk contains fewer samples than chunk_size at the real sample rate.
+	const float oversampled_rate = sample_rate * params.oversampling;
+	const float time_scale = 1.0f / params.oversampling;
+
+	// Operators that are not rendered still need their envelopes to progress
+	for (size_t s = 0; s < routing.skipped_count; ++s) {
+		auto i = routing.skipped[s];
+		ops[i].envelope.update_level(params.ops[i].envelope, ops[i].rate * time_scale * (end - begin));
+		ops[i].value = 0;
+	}
 
-			// Apply amplitude modulations
-			ops[i].value = ops[i].envelope.update(params.ops[i].envelope, ops[i].rate) * value * (ops[i].output_level);
+	// Pitch bend only changes between calls to render(), so this is constant for the whole range.
+	const float bend = std::exp2(params.bend * params.frequency.bend_sensitivity / 12.0f);
+	const float filter_bend = std::exp2(params.bend * params.filter.bend_sensitivity / 12.0f);
 
-			if (params.ops[i].am_level || params.modulation) {
-				// assume ops[7].value has range -1..1
-				ops[i].value *= 1.0f + (params.ops[i].am_level + params.modulation * params.ops[i].mod_sensitivity) * (ops[7].value - 1.0f) * 0.5;
-			}
+	for (size_t start = begin; start < end; start += params.control_period) {
+		const size_t length = std::min(params.control_period, end - start);
 
-			accum += ops[i].value * params.ops[i].output_level;
+		// Evaluate the pitch and filter modulation once per control period
+		float voice_freq_target = frequency.base * bend * dB_to_amplitude(frequency.envelope.update_level(params.frequency.envelope, frequency.rate * time_scale * length));
+
+		if (params.frequency.lfo_depth || params.modulation) {
+			voice_freq_target *= std::exp2((params.frequency.lfo_depth + params.frequency.mod_sensitivity * params.modulation) / 12.0f * ops[7].value);
 		}
 
-		// Apply the filter to the accumulated value so far
-		float filter_freq = filter.base * params.filter.frequency;
+		float filter_freq = filter.base * params.filter.frequency * filter_bend;
 
 		if (!params.filter.fixed) {
-			filter_freq *= voice_freq;
+			filter_freq *= voice_freq_target;
 		}
 
 		if (params.filter.lfo_depth || params.filter.mod_sensitivity) {
 			filter_freq *= std::exp2((params.filter.lfo_depth + params.modulation * params.filter.mod_sensitivity) / 12.0f * ops[7].value);
 		}
 
-		if (params.filter.bend_sensitivity) {
-			filter_freq *= std::exp2(params.bend * params.filter.bend_sensitivity / 12.0f);
+		svf_params.set_freq(dB_to_amplitude(filter.envelope.update_level(params.filter.envelope, filter.rate * time_scale * length)) * filter_freq * time_scale);
+		const float filter_f_target = svf_params.f;
+
+		if (!control.valid) {
+			control.voice_freq = voice_freq_target;
+			control.filter_f = filter_f_target;
+			control.valid = true;
+		}
+
+		// Interpolate linearly from the previous control point to avoid zipper noise
+		const float voice_freq_step = (voice_freq_target - control.voice_freq) / length;
+		const float filter_f_step = (filter_f_target - control.filter_f) / length;
+		float voice_freq = control.voice_freq;
+		svf_params.f = control.filter_f;
+
+		for (size_t n = start; n < start + length; ++n) {
+			float accum{};
+			voice_freq += voice_freq_step;
+			svf_params.f += filter_f_step;
+
+			for (size_t s = 0; s < routing.count; ++s) {
+				const auto &step = routing.steps[s];
+				const auto i = step.op;
+
+				// Update the unmodulated phase of the oscillator
+				float op_freq = params.ops[i].frequency;
+
+				if (!params.ops[i].fixed) {
+					op_freq *= voice_freq;
+				}
+
+				op_freq += params.ops[i].detune;
+				float sync = ops[i].osc.update_sync(op_freq / oversampled_rate);
+
+				// Determine the amount of phase modulation
+				float pm{};
+
+				for (size_t m = 0; m < M; ++m) {
+					pm += ops[step.modulators[m]].value * step.fm_levels[m];
+				}
+
+				// Get the oscillator's output value
+				float value;
+
+				switch (params.ops[i].waveform % 8) {
+				case 0:
+					value = ops[i].osc.sine(pm, params.sine_accuracy);
+					break;
+
+				case 1:
+					value = params.band_limited ? ops[i].osc.triangle_blamp(pm) : ops[i].osc.triangle(pm);
+					break;
+
+				case 2:
+					value = params.band_limited ? ops[i].osc.square_blep(pm) : ops[i].osc.square(pm);
+					break;
+
+				case 3:
+					value = params.band_limited ? ops[i].osc.saw_blep(pm) : ops[i].osc.saw(pm);
+					break;
+
+				case 4:
+					value = params.band_limited ? -ops[i].osc.saw_blep(pm) : -ops[i].osc.saw(pm);
+					break;
+
+				case 5:
+					value = noise();
+					break;
+
+				case 6:
+					value = sample_and_hold((sync + pm) < 0, ops[i].hold);
+					break;
+
+				case 7:
+					value = sample_and_hold(sync < 0, ops[i].hold, pm);
+					break;
+
+				default:
+					value = 0;
+					break;
+				}
+
+				// Apply amplitude modulations
+				ops[i].value = ops[i].envelope.update(params.ops[i].envelope, ops[i].rate * time_scale) * value * (ops[i].output_level);
+
+				if (step.am_level) {
+					// assume ops[7].value has range -1..1
+					ops[i].value *= 1.0f + step.am_level * (ops[7].value - 1.0f) * 0.5;
+				}
+
+				accum += ops[i].value * step.output_level;
+			}
+
+			// Apply the filter to the accumulated value so far
+			chunk.samples[n] += filter.svf(svf_params, accum);
 		}
 
-		params.filter.svf.set_freq(filter.envelope.update(params.filter.envelope, filter.rate) * filter_freq);
-		sample += filter.svf(params.filter.svf, accum);
+		control.voice_freq = voice_freq_target;
+		control.filter_f = filter_f_target;
 	}
 
 	return is_active();
 }
 
+template<size_t M>
+PLING_TARGET_CLONES bool Octalope::render_lockstep(Voice *const *group, size_t count, Chunk &chunk, size_t begin, size_t end, const Routing &routing) const
+{
+	using SIMD::vfloat;
+	using SIMD::broadcast;
+	const float oversampled_rate = sample_rate * params.oversampling;
+	const float time_scale = 1.0f / params.oversampling;
+
+	/* This does the same as Voice::render(), but for a group of voices at once,
+	 * with the state of each voice in its own lane of a vector.
+	 * Operator state is loaded into vectors here, and stored back at the end.
+	 * Envelopes are state machines, they are still updated one voice at a time,
+	 * but the conversion from dB to amplitude is vectorized. */
+	vfloat phase[8] {};
+	vfloat value[8] {};
+	vfloat hold[8] {};
+	vfloat output_level[8] {};
+	vfloat frequency_base{};
+	vfloat filter_base{};
+	vfloat control_voice_freq{};
+	vfloat control_filter_f{};
+	SIMD::vint control_valid{};
+
+	for (size_t l = 0; l < count; ++l) {
+		auto &voice = *group[l];
+
+		for (int i = 0; i < 8; ++i) {
+			phase[i][l] = voice.ops[i].osc;
+			value[i][l] = voice.ops[i].value;
+			hold[i][l] = voice.ops[i].hold;
+			output_level[i][l] = voice.ops[i].output_level;
+		}
+
+		frequency_base[l] = voice.frequency.base;
+		filter_base[l] = voice.filter.base;
+		control_voice_freq[l] = voice.control.voice_freq;
+		control_filter_f[l] = voice.control.filter_f;
+		control_valid[l] = voice.control.valid ? -1 : 0;
+
+		for (size_t s = 0; s < routing.skipped_count; ++s) {
+			auto i = routing.skipped[s];
+			voice.ops[i].envelope.update_level(params.ops[i].envelope, voice.ops[i].rate * time_scale * (end - begin));
+			value[i][l] = 0;
+		}
+	}
+
+	// Parameters that are constant for the whole range
+	const float bend = std::exp2(params.bend * params.frequency.bend_sensitivity / 12.0f);
+	const float filter_bend = std::exp2(params.bend * params.filter.bend_sensitivity / 12.0f);
+	const bool frequency_lfo = params.frequency.lfo_depth || params.modulation;
+	const float frequency_lfo_depth = (params.frequency.lfo_depth + params.frequency.mod_sensitivity * params.modulation) / 12.0f;
+	const bool filter_lfo = params.filter.lfo_depth || params.filter.mod_sensitivity;
+	const float filter_lfo_depth = (params.filter.lfo_depth + params.modulation * params.filter.mod_sensitivity) / 12.0f;
+	auto svf_params = params.filter.svf;
+
+	for (size_t start = begin; start < end; start += params.control_period) {
+		const size_t length = std::min(params.control_period, end - start);
+		vfloat level{};
+
+		// Evaluate the pitch and filter modulation once per control period
+		for (size_t l = 0; l < count; ++l) {
+			level[l] = group[l]->frequency.envelope.update_level(params.frequency.envelope, group[l]->frequency.rate * time_scale * length);
+		}
+
+		vfloat voice_freq_target = frequency_base * bend * SIMD::dB_to_amplitude(level);
+
+		if (frequency_lfo) {
+			voice_freq_target *= SIMD::exp2(frequency_lfo_depth * value[7]);
+		}
+
+		vfloat filter_freq = filter_base * params.filter.frequency * filter_bend;
+
+		if (!params.filter.fixed) {
+			filter_freq *= voice_freq_target;
+		}
+
+		if (filter_lfo) {
+			filter_freq *= SIMD::exp2(filter_lfo_depth * value[7]);
+		}
+
+		for (size_t l = 0; l < count; ++l) {
+			level[l] = group[l]->filter.envelope.update_level(params.filter.envelope, group[l]->filter.rate * time_scale * length);
+		}
+
+		// This is StateVariable::Parameters::set_freq(), with sin(x) = sine_turns(x / 2pi).
+		filter_freq *= SIMD::dB_to_amplitude(level);
+		vfloat filter_f_target = 2.0f * SIMD::sine_turns(SIMD::clamp(filter_freq * (0.5f / oversampled_rate), 0.0f, 1.0f / 12.0f));
+
+		control_voice_freq = SIMD::select(control_valid, control_voice_freq, voice_freq_target);
+		control_filter_f = SIMD::select(control_valid, control_filter_f, filter_f_target);
+		control_valid = SIMD::vint{} - 1;
+
+		// Interpolate linearly from the previous control point, like Voice::render() does.
+		const vfloat voice_freq_step = (voice_freq_target - control_voice_freq) / float(length);
+		const vfloat filter_f_step = (filter_f_target - control_filter_f) / float(length);
+		vfloat voice_freq = control_voice_freq;
+		vfloat f = control_filter_f;
+
+		for (size_t n = start; n < start + length; ++n) {
+			vfloat accum{};
+			voice_freq += voice_freq_step;
+			f += filter_f_step;
+
+			// Go through the operators in the same order as Voice::render() does.
+			for (size_t s = 0; s < routing.count; ++s) {
+				const auto &step = routing.steps[s];
+				const auto i = step.op;
+				const auto &op = params.ops[i];
+
+				// Update the unmodulated phase of the oscillator
+				vfloat op_freq = op.fixed ? broadcast(op.frequency) : voice_freq * op.frequency;
+				op_freq += op.detune;
+				vfloat prev = phase[i];
+				vfloat delta = op_freq / oversampled_rate;
+				phase[i] += delta;
+				phase[i] -= SIMD::floor(phase[i]);
+				vfloat sync = phase[i] - prev;
+
+				// Determine the amount of phase modulation
+				vfloat pm{};
+
+				for (size_t m = 0; m < M; ++m) {
+					pm += value[step.modulators[m]] * step.fm_levels[m];
+				}
+
+				// Get the oscillator's output value
+				vfloat wave{};
+
+				switch (op.waveform % 8) {
+				case 0:
+					if (params.sine_accuracy == Oscillator::PM::Accuracy::POLYNOMIAL) {
+						wave = SIMD::sine_turns(phase[i] + pm);
+					} else if (params.sine_accuracy == Oscillator::PM::Accuracy::WAVETABLE) {
+						for (size_t l = 0; l < count; ++l) {
+							wave[l] = Oscillator::PM::sine_wavetable(phase[i][l] + pm[l]);
+						}
+					} else {
+						for (size_t l = 0; l < count; ++l) {
+							wave[l] = std::sin((phase[i][l] + pm[l]) * float(2 * M_PI));
+						}
+					}
+
+					break;
+
+				case 1: {
+					vfloat t = SIMD::frac(phase[i] + pm - 0.25f);
+					wave = SIMD::abs(t - 0.5f) * 4.0f - 1.0f;
+
+					if (params.band_limited) {
+						vfloat t2 = SIMD::select(t < 0.5f, t + 0.5f, t - 0.5f);
+						wave += 4.0f * SIMD::abs(delta) * (Oscillator::poly_blamp(t2, delta) - Oscillator::poly_blamp(t, delta));
+					}
+
+					break;
+				}
+
+				case 2: {
+					vfloat t = SIMD::frac(phase[i] + pm);
+					wave = SIMD::select(t < 0.5f, broadcast(1.0f), broadcast(-1.0f));
+
+					if (params.band_limited) {
+						vfloat t2 = SIMD::select(t < 0.5f, t + 0.5f, t - 0.5f);
+						wave += Oscillator::poly_blep(t, delta) - Oscillator::poly_blep(t2, delta);
+					}
+
+					break;
+				}
+
+				case 3:
+				case 4: {
+					vfloat t = SIMD::frac(phase[i] + pm);
+					wave = t * -2.0f + 1.0f;
+
+					if (params.band_limited) {
+						wave += Oscillator::poly_blep(t, delta);
+					}
+
+					if (op.waveform % 8 == 4) {
+						wave = -wave;
+					}
+
+					break;
+				}
+
+				case 5:
+					for (size_t l = 0; l < count; ++l) {
+						wave[l] = noise();
+					}
+
+					break;
+
+				case 6:
+					for (size_t l = 0; l < count; ++l) {
+						wave[l] = sample_and_hold((sync[l] + pm[l]) < 0, hold[i][l]);
+					}
+
+					break;
+
+				case 7:
+					for (size_t l = 0; l < count; ++l) {
+						wave[l] = sample_and_hold(sync[l] < 0, hold[i][l], pm[l]);
+					}
+
+					break;
+
+				default:
+					wave = vfloat{};
+					break;
+				}
+
+				// Apply amplitude modulations
+				for (size_t l = 0; l < count; ++l) {
+					level[l] = group[l]->ops[i].envelope.update_level(op.envelope, group[l]->ops[i].rate * time_scale);
+				}
+
+				value[i] = SIMD::dB_to_amplitude(level) * wave * output_level[i];
+
+				if (step.am_level) {
+					value[i] *= 1.0f + step.am_level * (value[7] - 1.0f) * 0.5f;
+				}
+
+				accum += value[i] * step.output_level;
+			}
+
+			// Apply the filter to the accumulated value so far
+			float out{};
+
+			for (size_t l = 0; l < count; ++l) {
+				svf_params.f = f[l];
+				out += group[l]->filter.svf(svf_params, accum[l]);
+			}
+
+			chunk.samples[n] += out;
+		}
+
+		control_voice_freq = voice_freq_target;
+		control_filter_f = filter_f_target;
+	}
+
+	bool active = false;
+
+	for (size_t l = 0; l < count; ++l) {
+		auto &voice = *group[l];
+
+		for (int i = 0; i < 8; ++i) {
+			voice.ops[i].osc.init(phase[i][l]);
+			voice.ops[i].value = value[i][l];
+			voice.ops[i].hold = hold[i][l];
+		}
+
+		voice.control.voice_freq = control_voice_freq[l];
+		voice.control.filter_f = control_filter_f[l];
+		voice.control.valid = true;
+		active |= voice.is_active();
+	}
+
+	return active;
+}
+
 void Octalope::Voice::init(uint8_t key, float freq, float velocity, const Parameters &params)
 {
 	frequency.base = freq * std::exp2(params.frequency.transpose / 12.0f) * std::exp2(rng(params.frequency.randomize / 12.0f));
 	frequency.envelope.init(params.frequency.envelope);
 	filter.base = std::exp2(rng(params.filter.randomize / 12.0f));
 	filter.envelope.init(params.filter.envelope);
+	control.valid = false;
+	carriers = 0;
 
 	for (int i = 0; i < 8; ++i) {
+		if (params.ops[i].output_level != 0) {
+			carriers |= 1 << i;
+		}
+
 		auto keyboard_level = params.ops[i].keyboard_level_curve(freq);
 		auto keyboard_rate = params.ops[i].keyboard_rate_curve(freq);
 		auto velocity_level = params.ops[i].velocity_level_curve(velocity);
@@ -246,12 +653,115 @@ float Octalope::Voice::get_frequency(const Parameters &params) const
 	return frequency.base * std::exp2(params.bend * params.frequency.bend_sensitivity / 12.0f) * frequency.envelope.get();
 }
 
-bool Octalope::render(Chunk &chunk)
+Octalope::Octalope()
 {
-	bool active = false;
+	lockstep = config["octalope_lockstep"].as<bool>(true);
+	default_sine_accuracy = Oscillator::PM::parse_accuracy(config["sine_accuracy"].as<std::string>(""), default_sine_accuracy);
+	params.sine_accuracy = default_sine_accuracy;
+}
+
+template<size_t M>
+bool Octalope::render_voices(Chunk &chunk, size_t begin, size_t end, const Routing &routing)
+{
+	if (lockstep) {
+		return voices.render_groups<SIMD::lanes>(chunk, begin, end, [&](Voice * const * group, size_t count, Chunk & group_chunk) {
+			return render_lockstep<M>(group, count, group_chunk, begin, end, routing);
+		});
+	}
+
+	return voices.render(chunk, begin, end, [&](Voice & voice, Chunk & voice_chunk) {
+		return voice.render<M>(voice_chunk, begin, end, params, routing);
+	});
+}
+
+bool Octalope::render_routed(Chunk &chunk, size_t begin, size_t end, const Routing &routing)
+{
+	// Most algorithms have at most one or two modulators per operator, like the DX7 algorithms
+	switch (routing.max_modulators) {
+	case 0:
+	case 1:
+		return render_voices<1>(chunk, begin, end, routing);
+
+	case 2:
+		return render_voices<2>(chunk, begin, end, routing);
+
+	case 3:
+	case 4:
+		return render_voices<4>(chunk, begin, end, routing);
+
+	default:
+		return render_voices<8>(chunk, begin, end, routing);
+	}
+}
+
+void Octalope::prepare()
+{
+	voices.allocate(polyphony);
+}
+
+bool Octalope::render(Chunk &chunk, size_t begin, size_t end)
+{
+	/* The routing is compiled from the parameters at the start of every chunk,
+	 * since parameters can be changed at any time from MIDI and from the GUI.
+	 * This costs much less than rendering a single voice for a single sample. */
+	Routing routing;
+	routing.compile(params);
+
+	const size_t factor = params.oversampling;
+
+	if (factor == 1) {
+		return render_routed(chunk, begin, end, routing);
+	}
+
+	/* Render multiple chunks at the higher sample rate, then decimate them in one or two stages.
+	 * The requested range is mapped onto the oversampled chunks. These are only decimated
+	 * once the whole chunk has been rendered, since the decimators need consecutive input. */
+	if (begin == 0) {
+		for (size_t i = 0; i < factor; ++i) {
+			oversampled[i].clear();
+		}
+
+		oversampled_active = false;
+	}
+
+	for (size_t i = 0; i < factor; ++i) {
+		size_t oversampled_begin = std::max(begin * factor, i * chunk_size);
+		size_t oversampled_end = std::min(end * factor, (i + 1) * chunk_size);
+
+		if (oversampled_begin < oversampled_end) {
+			oversampled_active |= render_routed(oversampled[i], oversampled_begin - i * chunk_size, oversampled_end - i * chunk_size, routing);
+		}
+	}
 
-	for (auto &voice : voices) {
-		active |= voice.render(chunk, params);
+	if (end != chunk_size) {
+		return true;
+	}
+
+	const bool active = oversampled_active;
+
+	std::array<float, 2 * chunk_size> intermediate;
+	std::array<float, chunk_size> output;
+
+	if (factor == 2) {
+		decimators[0].process(oversampled[0].samples.data(), output.data(), chunk_size);
+		decimators[0].process(oversampled[1].samples.data(), output.data() + chunk_size / 2, chunk_size);
+	} else {
+		for (size_t i = 0; i < factor; ++i) {
+			decimators[0].process(oversampled[i].samples.data(), intermediate.data() + i * chunk_size / 2, chunk_size);
+		}
+
+		decimators[1].process(intermediate.data(), output.data(), 2 * chunk_size);
+	}
+
+	for (size_t i = 0; i < chunk_size; ++i) {
+		chunk.samples[i] += output[i];
+	}
+
+	// Don't let the filter history leak into the next note
+	if (!active) {
+		for (auto &decimator : decimators) {
+			decimator.reset();
+		}
 	}
 
 	return active;
@@ -644,6 +1154,24 @@ bool Octalope::load(const YAML::Node &yaml)
 		op.velocity_rate_curve.load(node["velocity_rate_curve"]);
 	}
 
+	params.control_period = std::clamp<size_t>(yaml["control_period"].as<size_t>(16), 1, chunk_size);
+	params.band_limited = yaml["band_limited"].as<bool>(true);
+	params.oversampling = yaml["oversampling"].as<size_t>(1);
+
+	if (params.oversampling != 2 && params.oversampling != 4) {
+		params.oversampling = 1;
+	}
+
+	voices.set_oversampling(params.oversampling);
+
+	for (auto &decimator : decimators) {
+		decimator.reset();
+	}
+
+	// If not set explicitly, use the global default, and don't save it with this program
+	custom_sine_accuracy = yaml["sine_accuracy"].IsDefined();
+	params.sine_accuracy = Oscillator::PM::parse_accuracy(yaml["sine_accuracy"].as<std::string>(""), default_sine_accuracy);
+
 	{
 		auto &node = yaml["frequency"];
 		params.frequency.transpose = node["transpose"].as<float>(0);
@@ -706,6 +1234,14 @@ YAML::Node Octalope::save()
 		yaml["operators"].push_back(node);
 	}
 
+	yaml["control_period"] = params.control_period;
+	yaml["band_limited"] = params.band_limited;
+	yaml["oversampling"] = params.oversampling;
+
+	if (custom_sine_accuracy) {
+		yaml["sine_accuracy"] = Oscillator::PM::get_accuracy_name(params.sine_accuracy);
+	}
+
 	{
 		YAML::Node node;
 		node["transpose"] = params.frequency.transpose;
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <vector>
 
@@ -10,6 +12,7 @@
 #include "../curves/keyboard-scaling-dx7.hpp"
 #include "../curves/velocity-scaling-dx7.hpp"
 #include "../envelopes/exponential-dx7.hpp"
+#include "../filters/half-band-decimator.hpp"
 #include "../filters/state-variable.hpp"
 #include "../pling.hpp"
 #include "../program.hpp"
@@ -70,6 +73,21 @@ class Octalope: public Program
 		float bend{};
 		float modulation{};
 
+		/**
+		 * The number of samples between evaluations of the pitch and filter modulation.
+		 * In between, the voice and filter frequencies are interpolated linearly.
+		 */
+		size_t control_period{16};
+
+		// How accurately sine waveforms are calculated
+		Oscillator::PM::Accuracy sine_accuracy{Oscillator::PM::Accuracy::POLYNOMIAL};
+
+		// Whether to use PolyBLEP/PolyBLAMP corrected square, saw and triangle waveforms
+		bool band_limited{true};
+
+		// Render at 1, 2 or 4 times the sample rate
+		size_t oversampling{1};
+
 		struct Frequency {
 			float transpose{1};
 			float randomize{};
@@ -116,6 +134,35 @@ class Octalope: public Program
 		} filter;
 	};
 
+	/**
+	 * The operators that need to be rendered, in the order in which they should be rendered,
+	 * together with their non-zero FM routings.
+	 *
+	 * Operators that are not audible, either directly or by modulating an audible operator,
+	 * are skipped. Modulators are rendered before the operators they modulate if possible,
+	 * so only feedback loops use the value from the previous sample.
+	 */
+	struct Routing {
+		struct Step {
+			uint8_t op;
+			uint8_t count;
+			uint8_t modulators[8];
+			float fm_levels[8];
+			float am_level;
+			float output_level;
+		};
+
+		Step steps[8];
+		size_t count{};
+		uint8_t skipped[8];
+		size_t skipped_count{};
+
+		// The highest number of modulators of any operator
+		size_t max_modulators{};
+
+		void compile(const Parameters &params);
+	};
+
 	struct Voice {
 
 		struct {
@@ -133,21 +180,69 @@ class Octalope: public Program
 
 		Operator ops[8];
 
+		// The operators that were audible when the voice was started, one bit per operator.
+		uint8_t carriers{};
+
+		// The voice and filter frequencies at the end of the last control period
+		struct {
+			float voice_freq;
+			float filter_f;
+			bool valid{};
+		} control;
+
 		void init(uint8_t key, float freq, float vel, const Parameters &params);
-		bool render(Chunk &chunk, Parameters &params);
+		template<size_t M>
+		bool render(Chunk &chunk, size_t begin, size_t end, const Parameters &params, const Routing &routing);
 		void release(const Parameters &params);
 		bool is_active()
 		{
 			return ops[0].envelope.is_active();
 		}
+		float get_level() const
+		{
+			float level = 0;
+
+			// Modulators only change the timbre, so only the carriers count.
+			for (int i = 0; i < 8; ++i) {
+				if (carriers & (1 << i)) {
+					level = std::max(level, ops[i].envelope.get() * ops[i].output_level);
+				}
+			}
+
+			return level;
+		}
 		float get_zero_crossing(float offset, const Parameters &params) const;
 		float get_frequency(const Parameters &params) const;
 	};
 
-	VoiceManager<Voice, 32> voices;
+	VoiceManager<Voice> voices;
 
 	Parameters params;
 
+	/**
+	 * Whether to render voices in lockstep, using one SIMD lane per voice.
+	 * If false, each voice is rendered separately by Voice::render().
+	 */
+	bool lockstep{true};
+
+	/**
+	 * The sine accuracy to use for programs that don't specify it themselves.
+	 * This can be set globally with the sine_accuracy configuration option.
+	 */
+	Oscillator::PM::Accuracy default_sine_accuracy{Oscillator::PM::Accuracy::POLYNOMIAL};
+	bool custom_sine_accuracy{};
+
+	// Chunks at the oversampled rate, and the filters to decimate them
+	std::array<Chunk, 4> oversampled;
+	Filter::HalfBandDecimator decimators[2];
+	bool oversampled_active{};
+
+	bool render_routed(Chunk &chunk, size_t begin, size_t end, const Routing &routing);
+	template<size_t M>
+	bool render_voices(Chunk &chunk, size_t begin, size_t end, const Routing &routing);
+	template<size_t M>
+	bool render_lockstep(Voice *const *group, size_t count, Chunk &chunk, size_t begin, size_t end, const Routing &routing) const;
+
 	enum class Context {
 		NONE,
 		MAIN,
@@ -191,7 +286,10 @@ class Octalope: public Program
 	void set_envelope(MIDI::Control control, uint8_t val, Envelope::ExponentialDX7::Parameters &envelope, float from, float to);
 
 public:
-	virtual bool render(Chunk &chunk) final;
+	Octalope();
+
+	virtual void prepare() final;
+	virtual bool render(Chunk &chunk, size_t begin, size_t end) final;
 	virtual void note_on(uint8_t key, uint8_t vel) final;
 	virtual void note_off(uint8_t key, uint8_t vel) final;
 	virtual void pitch_bend(int16_t value) final;
@@ -10,11 +10,15 @@
 #include "../program-manager.hpp"
 #include "utils.hpp"
 
-bool Simple::Voice::render(Chunk &chunk, Parameters &params)
+bool Simple::Voice::render(Chunk &chunk, size_t begin, size_t end, const Parameters &params)
 {
-	for (auto &sample : chunk.samples) {
-		params.svf.set_freq(filter_envelope.update(params.filter_envelope) * params.freq);
-		sample += svf(params.svf, osc.saw() * amp * amplitude_envelope.update(params.amplitude_envelope) * (1 - (lfo.fast_sine() * 0.5 + 0.5) * params.mod));
+	// Voices can be rendered in parallel, so use a private copy of the filter parameters.
+	auto svf_params = params.svf;
+
+	for (size_t i = begin; i < end; ++i) {
+		auto &sample = chunk.samples[i];
+		svf_params.set_freq(filter_envelope.update(params.filter_envelope) * params.freq);
+		sample += svf(svf_params, osc.saw_blep(params.bend) * amp * amplitude_envelope.update(params.amplitude_envelope) * (1 - (lfo.fast_sine() * 0.5 + 0.5) * params.mod));
 		++lfo;
 		osc.update(params.bend);
 	}
@@ -47,15 +51,16 @@ float Simple::Voice::get_frequency(const Parameters &params) const
 	return osc.get_frequency(params.bend);
 }
 
-bool Simple::render(Chunk &chunk)
+void Simple::prepare()
 {
-	bool active = false;
-
-	for (auto &voice : voices) {
-		active |= voice.render(chunk, params);
-	}
+	voices.allocate(polyphony);
+}
 
-	return active;
+bool Simple::render(Chunk &chunk, size_t begin, size_t end)
+{
+	return voices.render(chunk, begin, end, [&](Voice & voice, Chunk & voice_chunk) {
+		return voice.render(voice_chunk, begin, end, params);
+	});
 }
 
 float Simple::get_zero_crossing(float offset) const
@@ -38,17 +38,21 @@ class Simple: public Program
 		Filter::StateVariable svf;
 
 		void init(uint8_t key, float freq, float vel);
-		bool render(Chunk &chunk, Parameters &params);
+		bool render(Chunk &chunk, size_t begin, size_t end, const Parameters &params);
 		void release();
 		bool is_active()
 		{
 			return amplitude_envelope.is_active();
 		}
+		float get_level() const
+		{
+			return amplitude_envelope.get();
+		}
 		float get_zero_crossing(float offset, const Parameters &params) const;
 		float get_frequency(const Parameters &params) const;
 	};
 
-	VoiceManager<Voice, 32> voices;
+	VoiceManager<Voice> voices;
 
 	Parameters params;
 
@@ -78,7 +82,8 @@ class Simple: public Program
 	}
 
 public:
-	virtual bool render(Chunk &chunk) final;
+	virtual void prepare() final;
+	virtual bool render(Chunk &chunk, size_t begin, size_t end) final;
 	virtual void note_on(uint8_t key, uint8_t vel) final;
 	virtual void note_off(uint8_t key, uint8_t vel) final;
 	virtual void pitch_bend(int16_t value) final;
@@ -2,77 +2,496 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "../pling.hpp"
+#include "../voice-governor.hpp"
+#include "../worker-pool.hpp"
 
 /**
- * A manager for a fixed number of polyphonic voices.
+ * A pool of voice arrays, shared by all VoiceManagers with the same type of voice.
+ *
+ * Array sizes are rounded up to a power of two. When a program is destroyed, its voices are kept
+ * for the next program that needs the same number, so changing programs does not repeatedly
+ * allocate and construct large arrays. Never used from the audio thread.
  */
-template <typename Voice, uint32_t N>
+template <typename Voice>
+class VoicePool
+{
+	// The number of unused arrays of each size to keep.
+	static constexpr size_t max_kept = 4;
+
+	std::mutex mutex;
+	std::unordered_map<uint32_t, std::vector<std::unique_ptr<Voice[]>>> kept;
+
+public:
+	static VoicePool &get()
+	{
+		// Never destroyed, since programs can outlive any static pool.
+		static auto pool = new VoicePool;
+		return *pool;
+	}
+
+	static uint32_t round_up(uint32_t size)
+	{
+		uint32_t rounded = 1;
+
+		while (rounded < size) {
+			rounded *= 2;
+		}
+
+		return rounded;
+	}
+
+	/**
+	 * Get an array of at least the given number of voices.
+	 * Reused voices are not reset, VoiceManager initializes voices when they are pressed.
+	 */
+	std::unique_ptr<Voice[]> take(uint32_t size)
+	{
+		size = round_up(size);
+
+		{
+			std::lock_guard lock(mutex);
+			auto &arrays = kept[size];
+
+			if (!arrays.empty()) {
+				auto voices = std::move(arrays.back());
+				arrays.pop_back();
+				return voices;
+			}
+		}
+
+		return std::make_unique<Voice[]>(size);
+	}
+
+	/**
+	 * Return an array obtained from take() to the pool.
+	 */
+	void give(std::unique_ptr<Voice[]> voices, uint32_t size)
+	{
+		size = round_up(size);
+		std::lock_guard lock(mutex);
+		auto &arrays = kept[size];
+
+		if (arrays.size() < max_kept) {
+			arrays.push_back(std::move(voices));
+		}
+	}
+};
+
+/**
+ * A manager for a number of polyphonic voices.
+ *
+ * The number of voices is chosen at runtime. The voices are only allocated when allocate() is called,
+ * which programs do when they are first activated, so programs that are never played do not use memory for voices.
+ * Once allocated, the voices are kept until the manager is destroyed, even while the program is silent,
+ * since other threads may still look at them. They are then returned to the VoicePool.
+ *
+ * Voices are kept in intrusive lists of free, released and held voices, so allocating one takes constant time,
+ * and the active voices are also kept in a dense index, so rendering only touches those.
+ * Voices must provide is_active(), and get_level() returning their current amplitude,
+ * which is used to decide which voice to steal, or which voices to shed when the voice governor lowers the voice limit.
+ * Voices must be swappable without allocating memory, so a stolen voice can be faded out.
+ */
+template <typename Voice>
 class VoiceManager
 {
-	bool sustain;
+	// Indicates the absence of a voice in lists and indices.
+	static constexpr uint16_t none = UINT16_MAX;
+
+	// The number of samples over which a stolen voice is faded out.
+	static constexpr size_t fade_samples = 256;
+
+	// The number of stolen voices that can fade out at the same time.
+	static constexpr size_t max_fading = 4;
+
+	/**
+	 * The lists a voice can be in. Each list is ordered from the oldest to the youngest voice.
+	 */
+	enum List: uint8_t {
+		FREE,     /// Voices that are not producing sound.
+		RELEASED, /// Active voices whose key has been released.
+		HELD,     /// Active voices whose key is pressed or sustained.
+	};
+
+	bool sustain{};
+	uint32_t capacity{};
+
+	// The number of rendered samples per output sample, see set_oversampling().
+	uint32_t oversampling{1};
 
 	/**
 	 * The state for a voice.
 	 */
 	struct State {
 		uint8_t key;
-		bool active: 1;   /// Whether the voice is producing sound.
-		bool pressed: 1;  /// Whether the key is pressed for this voice.
+		uint8_t list;      /// The list this voice is in.
+		bool pressed: 1;   /// Whether the key is pressed for this voice.
 		bool sustained: 1; /// Whether the key was pressed while sustain is on.
+		uint16_t prev;     /// The previous voice in the same list, or none.
+		uint16_t next;     /// The next voice in the same list, or none.
+		uint16_t index;    /// The position of an active voice in the active voice index.
+
+		bool is_active() const
+		{
+			return list != FREE;
+		}
 
 		bool is_released() const
 		{
 			return !pressed && !sustained;
 		}
-	} state[N] {};
+	};
+
+	std::vector<State> state;
+
+	struct {
+		uint16_t head;
+		uint16_t tail;
+		uint32_t count;
+	} lists[3] {{none, none, 0}, {none, none, 0}, {none, none, 0}};
+
+	// The active voice for each key, or none.
+	uint16_t key_voices[256];
+
+	// The indices of all active voices, in no particular order.
+	std::vector<uint16_t> active_voices;
+	uint32_t nactive{};
+
+	std::unique_ptr<Voice[]> voices;
+
+	// Voices that were stolen, and are faded out to avoid a click. A gain of zero means the slot is unused.
+	struct {
+		Voice voice{};
+		float gain{};
+	} fading[max_fading];
+	Chunk fade_chunk;
+
+	// Per-group output used when rendering voices in parallel. Sized for groups of one voice,
+	// so render_groups() never allocates on the audio thread.
+	std::vector<Chunk> voice_chunks;
+
+	// The voices to render, and whether each group is still active, used by render_groups().
+	std::vector<Voice *> group_voices;
+	std::vector<uint8_t> group_active;
+
+	void unlink(uint32_t i)
+	{
+		auto &list = lists[state[i].list];
+
+		if (state[i].prev != none) {
+			state[state[i].prev].next = state[i].next;
+		} else {
+			list.head = state[i].next;
+		}
+
+		if (state[i].next != none) {
+			state[state[i].next].prev = state[i].prev;
+		} else {
+			list.tail = state[i].prev;
+		}
+
+		list.count--;
+	}
+
+	void append(uint32_t i, List to)
+	{
+		auto &list = lists[to];
+
+		state[i].list = to;
+		state[i].prev = list.tail;
+		state[i].next = none;
+
+		if (list.tail != none) {
+			state[list.tail].next = i;
+		} else {
+			list.head = i;
+		}
+
+		list.tail = i;
+		list.count++;
+	}
+
+	/**
+	 * Move a voice to the end of a list, adding it to or removing it from the active voice index if needed.
+	 */
+	void move(uint32_t i, List to)
+	{
+		if (!state[i].is_active() && to != FREE) {
+			state[i].index = nactive;
+			active_voices[nactive++] = i;
+		} else if (state[i].is_active() && to == FREE) {
+			// Move the last active voice into the hole.
+			auto last = active_voices[--nactive];
+			active_voices[state[i].index] = last;
+			state[last].index = state[i].index;
+		}
+
+		unlink(i);
+		append(i, to);
+	}
+
+	/**
+	 * Mark a voice as no longer producing sound.
+	 */
+	void deactivate(uint32_t i)
+	{
+		if (key_voices[state[i].key] == i) {
+			key_voices[state[i].key] = none;
+		}
+
+		state[i].pressed = false;
+		state[i].sustained = false;
+		move(i, FREE);
+	}
+
+	uint32_t count_active() const
+	{
+		return nactive;
+	}
+
+	/**
+	 * Find the quietest voice in a list.
+	 *
+	 * @param list          The list to search.
+	 * @param skip_pressed  Ignore voices whose key is pressed.
+	 * @return              The index of the voice, or none if there is no such voice.
+	 */
+	uint32_t find_quietest(List list, bool skip_pressed) const
+	{
+		uint32_t candidate = none;
+		float candidate_level{};
+
+		for (uint32_t i = lists[list].head; i != none; i = state[i].next) {
+			if (skip_pressed && state[i].pressed) {
+				continue;
+			}
+
+			float level = voices[i].get_level();
+
+			if (candidate == none || level < candidate_level) {
+				candidate = i;
+				candidate_level = level;
+			}
+		}
+
+		return candidate;
+	}
+
+	/**
+	 * Choose an active voice to reuse for a new note.
+	 *
+	 * Prefer the quietest released voice, then the quietest voice that is only held by the sustain pedal,
+	 * and finally the oldest pressed voice.
+	 */
+	uint32_t find_victim() const
+	{
+		auto i = find_quietest(RELEASED, false);
+
+		if (i == none) {
+			i = find_quietest(HELD, true);
+		}
+
+		if (i == none) {
+			i = lists[HELD].head;
+		}
+
+		return i;
+	}
+
+	/**
+	 * Take over an active voice, moving its sound to a free fading slot.
+	 * If all slots are in use, the voice that has been fading out the longest is cut off.
+	 */
+	void steal(uint32_t i)
+	{
+		if (key_voices[state[i].key] == i) {
+			key_voices[state[i].key] = none;
+		}
+
+		// All fades have the same slope, so the lowest gain belongs to the oldest one.
+		auto slot = std::min_element(std::begin(fading), std::end(fading), [](auto &a, auto &b) {
+			return a.gain < b.gain;
+		});
+
+		std::swap(voices[i], slot->voice);
+		slot->gain = 1;
+	}
+
+	bool can_fade() const
+	{
+		return std::any_of(std::begin(fading), std::end(fading), [](auto &slot) {
+			return slot.gain <= 0;
+		});
+	}
+
+	/**
+	 * Fade out the quietest voices until there are no more than the voice governor allows.
+	 * Released voices are shed before held ones.
+	 * Only as many voices are shed as there are free fading slots, the rest follow in later chunks.
+	 */
+	void shed()
+	{
+		auto count = count_active();
+		auto limit = voice_governor.get_limit();
+		voice_governor.report(count);
+
+		for (; count > limit && can_fade(); --count) {
+			auto i = find_quietest(RELEASED, false);
+
+			if (i == none) {
+				i = find_quietest(HELD, false);
+			}
+
+			steal(i);
+			deactivate(i);
+		}
+	}
 
-	Voice voices[N] {};
+	/**
+	 * Render the fading voices with a linearly decreasing gain, adding their output to a chunk.
+	 *
+	 * @return True if any voice is still fading out.
+	 */
+	template<typename Func>
+	bool render_fading(Chunk &chunk, size_t begin, size_t end, Func &render_func)
+	{
+		const float step = 1.0f / (fade_samples * oversampling);
+		bool active = false;
+
+		for (auto &slot : fading) {
+			if (slot.gain <= 0) {
+				continue;
+			}
+
+			Voice *group[1] = {&slot.voice};
+
+			std::fill(fade_chunk.samples.begin() + begin, fade_chunk.samples.begin() + end, 0.0f);
+			bool sounding = render_func(group, 1, fade_chunk);
+
+			// The voice may have ended within this range, but what it rendered up to that point still needs fading.
+			for (size_t i = begin; i < end && slot.gain > 0; ++i) {
+				chunk.samples[i] += fade_chunk.samples[i] * slot.gain;
+				slot.gain -= step;
+			}
+
+			slot.gain = sounding ? std::max(slot.gain, 0.0f) : 0.0f;
+			active |= slot.gain > 0;
+		}
+
+		return active;
+	}
 
 public:
+	// The voice governor's limit must be able to reach any capacity, otherwise it would always be in effect.
+	static constexpr uint32_t max_voices = VoiceGovernor::unlimited;
+
+	VoiceManager()
+	{
+		std::fill(std::begin(key_voices), std::end(key_voices), none);
+	}
+
+	VoiceManager(const VoiceManager &) = delete;
+	VoiceManager &operator=(const VoiceManager &) = delete;
+
+	~VoiceManager()
+	{
+		if (voices) {
+			VoicePool<Voice>::get().give(std::move(voices), capacity);
+		}
+	}
+
+	/**
+	 * Allocate the voices, if that has not been done yet. Must not be called from the audio thread.
+	 *
+	 * @param capacity  The number of voices, between 1 and max_voices.
+	 */
+	void allocate(uint32_t capacity)
+	{
+		if (voices) {
+			return;
+		}
+
+		capacity = std::clamp<uint32_t>(capacity, 1, max_voices);
+
+		state.resize(capacity);
+		active_voices.resize(capacity);
+		group_voices.resize(capacity);
+		group_active.resize(capacity);
+		voice_chunks.resize(capacity);
+		voices = VoicePool<Voice>::get().take(capacity);
+		this->capacity = capacity;
+
+		for (uint32_t i = 0; i < capacity; ++i) {
+			append(i, FREE);
+		}
+	}
+
+	uint32_t get_capacity() const
+	{
+		return capacity;
+	}
+
+	/**
+	 * Set how many samples voices render per output sample,
+	 * so stolen voices still fade out over the same time when a program is oversampled.
+	 */
+	void set_oversampling(uint32_t factor)
+	{
+		oversampling = factor;
+	}
+
 	/**
 	 * An iterator for going through all active voices.
+	 *
+	 * Voices that turn out to have become silent are deactivated along the way.
+	 * This moves the last voice of the active voice index into the current position,
+	 * so the iterator only advances once it has found an active voice.
 	 */
 	class Iterator
 	{
 		friend class VoiceManager;
 		VoiceManager &manager;
-		uint32_t i;
+		uint32_t pos;
 
 		Iterator(VoiceManager &manager, bool begin): manager(manager)
 		{
-			if (begin) {
-				for (i = 0; i < N; ++i) {
-					if (manager.state[i].active) {
-						if (manager.voices[i].is_active()) {
-							break;
-						} else {
-							manager.state[i].active = false;
-						}
-					}
-				}
-			} else {
-				i = N;
+			pos = begin ? 0 : none;
+			skip_silent();
+		}
+
+		void skip_silent()
+		{
+			while (pos < manager.nactive && !manager.voices[manager.active_voices[pos]].is_active()) {
+				manager.deactivate(manager.active_voices[pos]);
+			}
+
+			if (pos >= manager.nactive) {
+				pos = none;
 			}
 		}
 
 	public:
 		Voice &operator*()
 		{
-			return manager.voices[i];
+			return manager.voices[manager.active_voices[pos]];
 		}
 
 		Voice *operator->()
 		{
-			return &manager.voices[i];
+			return &manager.voices[manager.active_voices[pos]];
 		}
 
 		bool operator==(const Iterator &other)
 		{
-			return i == other.i;
+			return pos == other.pos;
 		}
 
 		bool operator!=(const Iterator &other)
@@ -82,15 +501,8 @@ public:
 
 		Iterator &operator++()
 		{
-			while (i < N) {
-				if (manager.state[++i].active) {
-					if (manager.voices[i].is_active()) {
-						break;
-					} else {
-						manager.state[i].active = false;
-					}
-				}
-			}
+			++pos;
+			skip_silent();
 
 			return *this;
 		}
@@ -99,38 +511,37 @@ public:
 	/**
 	 * Get the voice for a pressed key.
 	 *
-	 * If no voice exists yet for the given key, activate a new voice.
-	 * If there are no free voices, try to reuse a non-pressed voice.
-	 * If there are no free non-pressed voices, return nullptr.
+	 * If a voice exists for the given key, reuse it.
+	 * Otherwise, activate a free voice, unless the voice governor's limit has been reached.
+	 * If no free voice can be used, steal an active voice, see find_victim(),
+	 * and fade out its sound over a few milliseconds.
 	 *
 	 * @param key  A MIDI key number.
 	 * @return     A pointer to a voice, or nullptr if there is no suitable voice.
 	 */
 	Voice *press(uint8_t key)
 	{
-		unsigned int candidate = N;
+		uint32_t candidate = key_voices[key];
 
-		for (unsigned int i = 0; i < N; ++i) {
-			if (state[i].key == key) {
-				candidate = i;
-				break;
-			}
+		if (candidate == none) {
+			if (lists[FREE].count && count_active() < voice_governor.get_limit()) {
+				candidate = lists[FREE].head;
+			} else {
+				candidate = find_victim();
 
-			if (!state[i].active && (candidate == N || state[candidate].active)) {
-				candidate = i;
-			} else if (candidate == N && !state[i].pressed) {
-				candidate = i;
-			}
-		}
+				if (candidate == none) {
+					return nullptr;
+				}
 
-		if (candidate == N) {
-			return nullptr;
+				steal(candidate);
+			}
 		}
 
+		key_voices[key] = candidate;
 		state[candidate].key = key;
-		state[candidate].active = true;
 		state[candidate].pressed = true;
 		state[candidate].sustained = sustain;
+		move(candidate, HELD);
 
 		return &voices[candidate];
 	}
@@ -143,14 +554,21 @@ public:
 	 */
 	Voice *release(uint8_t key)
 	{
-		for (unsigned int i = 0; i < N; ++i) {
-			if (state[i].active && state[i].key == key) {
-				state[i].pressed = false;
-				return !state[i].sustained ? &voices[i] : nullptr;
-			}
+		uint32_t i = key_voices[key];
+
+		if (i == none) {
+			return {};
+		}
+
+		state[i].pressed = false;
+
+		if (state[i].sustained) {
+			return nullptr;
 		}
 
-		return {};
+		move(i, RELEASED);
+
+		return &voices[i];
 	}
 
 	/**
@@ -158,9 +576,14 @@ public:
 	 */
 	void release_all(std::function<void(Voice &)> release_func)
 	{
-		for (unsigned int i = 0; i < N; ++i) {
+		for (uint32_t pos = 0; pos < nactive; ++pos) {
+			auto i = active_voices[pos];
 			state[i].pressed = false;
 			release_func(voices[i]);
+
+			if (state[i].list == HELD && !state[i].sustained) {
+				move(i, RELEASED);
+			}
 		}
 	}
 
@@ -175,16 +598,19 @@ public:
 
 		if (sustain) {
 			// Mark all pressed keys as being sustained
-			for (unsigned int i = 0; i < N; ++i) {
-				if (state[i].active && state[i].pressed) {
+			for (uint32_t i = lists[HELD].head; i != none; i = state[i].next) {
+				if (state[i].pressed) {
 					state[i].sustained = true;
 				}
 			}
 		} else {
 			// Release all non-pressed sustained keys
-			for (unsigned int i = 0; i < N; ++i) {
-				if (state[i].active && state[i].sustained && !state[i].pressed) {
+			for (uint32_t pos = 0; pos < nactive; ++pos) {
+				auto i = active_voices[pos];
+
+				if (state[i].list == HELD && state[i].sustained && !state[i].pressed) {
 					release_func(voices[i]);
+					move(i, RELEASED);
 				}
 
 				state[i].sustained = false;
@@ -199,23 +625,109 @@ public:
 	 */
 	const Voice *get_lowest() const
 	{
-		unsigned int candidate = N;
+		unsigned int candidate = none;
 
-		for (unsigned int i = 0; i < N; ++i) {
-			if (!state[i].active) {
-				continue;
-			}
+		for (uint32_t pos = 0; pos < nactive; ++pos) {
+			auto i = active_voices[pos];
 
-			if (candidate != N && state[i].key > state[candidate].key && state[i].is_released() >= state[candidate].is_released()) {
+			if (candidate != none && state[i].key > state[candidate].key && state[i].is_released() >= state[candidate].is_released()) {
 				continue;
 			}
 
-			if (candidate == N || !state[i].is_released() || state[candidate].is_released()) {
+			if (candidate == none || !state[i].is_released() || state[candidate].is_released()) {
 				candidate = i;
 			}
 		}
 
-		return candidate < N ? &voices[candidate] : nullptr;
+		return candidate != none ? &voices[candidate] : nullptr;
+	}
+
+	/**
+	 * Render all active voices, adding their output to a chunk.
+	 *
+	 * If there are multiple render threads, the active voices are distributed over them,
+	 * each voice rendering into its own chunk. These are then summed in voice order,
+	 * so the result is the same regardless of the number of threads.
+	 *
+	 * @param chunk        The chunk to add the output of all voices to.
+	 * @param begin        The first sample the render function renders.
+	 * @param end          One past the last sample the render function renders.
+	 * @param render_func  A function that renders a voice into a chunk,
+	 *                     returning whether the voice is still active.
+	 * @return             True if any voice is still active.
+	 */
+	template<typename Func>
+	bool render(Chunk &chunk, size_t begin, size_t end, Func render_func)
+	{
+		return render_groups<1>(chunk, begin, end, [&](Voice * const * group, size_t count, Chunk & group_chunk) {
+			return render_func(*group[0], group_chunk);
+		});
+	}
+
+	/**
+	 * Render all active voices in groups, adding their output to a chunk.
+	 *
+	 * This works like render(), except that up to G voices are passed to the render function at once,
+	 * so they can be rendered in lockstep. Only the last group can have less than G voices.
+	 *
+	 * @param chunk        The chunk to add the output of all voices to.
+	 * @param begin        The first sample the render function renders.
+	 * @param end          One past the last sample the render function renders.
+	 * @param render_func  A function that renders a group of voices into a chunk,
+	 *                     given a pointer to an array of voices and the number of voices in the group,
+	 *                     returning whether any of the voices is still active.
+	 * @return             True if any voice is still active.
+	 */
+	template<size_t G, typename Func>
+	bool render_groups(Chunk &chunk, size_t begin, size_t end, Func render_func)
+	{
+		struct {
+			Voice **voices;
+			uint8_t *active;
+			Chunk *chunks;
+			Func *render_func;
+		} batch;
+
+		batch.voices = group_voices.data();
+		batch.active = group_active.data();
+
+		size_t nvoices = 0;
+		shed();
+
+		for (auto &voice : *this) {
+			batch.voices[nvoices++] = &voice;
+		}
+
+		size_t ngroups = (nvoices + G - 1) / G;
+		bool active = false;
+
+		active |= render_fading(chunk, begin, end, render_func);
+
+		if (worker_pool.size() == 1 || ngroups < 2) {
+			for (size_t i = 0; i < ngroups; ++i) {
+				active |= render_func(batch.voices + i * G, std::min(G, nvoices - i * G), chunk);
+			}
+
+			return active;
+		}
+
+		batch.chunks = voice_chunks.data();
+		batch.render_func = &render_func;
+
+		worker_pool.run(ngroups, [&batch, nvoices](size_t i) {
+			batch.chunks[i].clear();
+			batch.active[i] = (*batch.render_func)(batch.voices + i * G, std::min(G, nvoices - i * G), batch.chunks[i]);
+		});
+
+		for (size_t i = 0; i < ngroups; ++i) {
+			for (size_t j = 0; j < chunk_size; ++j) {
+				chunk.samples[j] += batch.chunks[i].samples[j];
+			}
+
+			active |= batch.active[i];
+		}
+
+		return active;
 	}
 
 	/**
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "render-monitor.hpp"
+
+#include <algorithm>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "pling.hpp"
+
+void RenderMonitor::start(float sample_rate, size_t period_size)
+{
+	using clock = std::chrono::steady_clock;
+
+	// The cycle counter runs at a fixed rate on all supported CPUs, so measure it once.
+	auto begin_time = clock::now();
+	auto begin = now();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	auto end_time = clock::now();
+	auto end = now();
+
+	ticks_per_second = (end - begin) / std::chrono::duration<double>(end_time - begin_time).count();
+	set_period_size(period_size);
+	set_sample_rate(sample_rate);
+}
+
+void RenderMonitor::set_sample_rate(float sample_rate)
+{
+	double deadline = chunk_size / sample_rate;
+
+	deadline_us.store(deadline * 1e6, std::memory_order_relaxed);
+	load_per_tick.store(1.0 / (ticks_per_second * deadline), std::memory_order_relaxed);
+}
+
+void RenderMonitor::set_period_size(size_t period_size)
+{
+	late_load.store(2.0f * std::max(period_size, chunk_size) / chunk_size, std::memory_order_relaxed);
+}
+
+float RenderMonitor::record(uint64_t begin)
+{
+	auto end = now();
+	float per_tick = load_per_tick.load(std::memory_order_relaxed);
+
+	if (!per_tick) {
+		return 0;
+	}
+
+	float load = (end - begin) * per_tick;
+	size_t bin = std::min<size_t>(load * (bins / max_load), bins - 1);
+
+	increment(histogram[bin]);
+	increment(chunks);
+
+	if (load > 1) {
+		increment(overruns);
+	}
+
+	if (last_begin && (begin - last_begin) * per_tick > late_load.load(std::memory_order_relaxed)) {
+		increment(late_callbacks);
+	}
+
+	// Average over roughly the last quarter of a second.
+	float average = average_load.load(std::memory_order_relaxed);
+	average_load.store(average + (load - average) * 0.01f, std::memory_order_relaxed);
+
+	if (load > peak_load.load(std::memory_order_relaxed)) {
+		peak_load.store(load, std::memory_order_relaxed);
+	}
+
+	last_begin = begin;
+
+	return load;
+}
+
+RenderMonitor::Histogram RenderMonitor::get_histogram() const
+{
+	Histogram result;
+
+	for (size_t i = 0; i < bins; ++i) {
+		result[i] = histogram[i].load(std::memory_order_relaxed);
+	}
+
+	return result;
+}
+
+float RenderMonitor::get_percentile(float fraction) const
+{
+	auto counts = get_histogram();
+	uint64_t total = 0;
+
+	for (auto count : counts) {
+		total += count;
+	}
+
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < bins; ++i) {
+		sum += counts[i];
+
+		if (total && sum >= fraction * total) {
+			return (i + 1) * max_load / bins;
+		}
+	}
+
+	return 0;
+}
+
+void RenderMonitor::dump(const std::filesystem::path &filename) const
+{
+	std::ofstream file(filename);
+
+	fmt::print(file, "# Audio callback render times, as a percentage of the {:.1f} µs deadline\n", get_deadline_us());
+	fmt::print(file, "chunks: {}\n", get_chunks());
+	fmt::print(file, "overruns: {}\n", get_overruns());
+	fmt::print(file, "late_callbacks: {}\n", get_late_callbacks());
+	fmt::print(file, "p50: {:.0f}%\n", get_percentile(0.5f) * 100);
+	fmt::print(file, "p99: {:.0f}%\n", get_percentile(0.99f) * 100);
+	fmt::print(file, "max: {:.0f}%\n", get_peak_load() * 100);
+	fmt::print(file, "histogram:\n");
+
+	auto counts = get_histogram();
+
+	for (size_t i = 0; i < bins; ++i) {
+		fmt::print(file, "  - [{:.0f}, {}]\n", (i + 1) * max_load / bins * 100, counts[i]);
+	}
+
+	file.close();
+
+	if (file.fail()) {
+		fmt::print(std::cerr, "Could not write render times to {}\n", filename);
+	}
+}
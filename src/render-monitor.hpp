@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+#include "pling.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Keeps track of how close the audio callback comes to its deadline.
+ *
+ * The audio thread timestamps each callback with the CPU's cycle counter,
+ * which is much cheaper than reading the system clock,
+ * and adds the render time to a histogram without taking any locks.
+ * All other threads may read the statistics at any time.
+ */
+class RenderMonitor
+{
+public:
+	// The histogram covers render times from 0 to twice the deadline, the last bin also counts anything longer.
+	static const size_t bins = 50;
+	static constexpr float max_load = 2.0f;
+
+	using Histogram = std::array<uint64_t, bins>;
+
+	/**
+	 * Read the cycle counter.
+	 */
+	static uint64_t now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		uint64_t value;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+		return value;
+#else
+		return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+	}
+
+	/**
+	 * Calibrate the cycle counter, and set the deadline for rendering one chunk.
+	 * Until this is called, nothing is recorded.
+	 *
+	 * @param period_size  The number of frames the audio device asks for at once.
+	 *                     If this is more than a chunk, several chunks are rendered back to back.
+	 */
+	void start(float sample_rate, size_t period_size = chunk_size);
+
+	/**
+	 * Update the period size when the audio device changes it. Can be called from any thread.
+	 */
+	void set_period_size(size_t period_size);
+
+	/**
+	 * Update the deadline when the audio device changes its sample rate. Can be called from any thread after start().
+	 */
+	void set_sample_rate(float sample_rate);
+
+	/**
+	 * Record the time it took to handle an audio callback. Only the audio thread may call this.
+	 *
+	 * @param begin  The value of now() at the start of the callback.
+	 * @return       The time it took, as a fraction of the deadline.
+	 */
+	float record(uint64_t begin);
+
+	/**
+	 * Get the time elapsed since begin, as a fraction of the deadline.
+	 */
+	float get_load(uint64_t begin) const
+	{
+		return (now() - begin) * load_per_tick.load(std::memory_order_relaxed);
+	}
+
+	Histogram get_histogram() const;
+
+	/**
+	 * Get the load below which the given fraction of all callbacks were.
+	 *
+	 * The result is rounded up to the upper edge of the histogram bin it falls in.
+	 */
+	float get_percentile(float fraction) const;
+
+	/**
+	 * Get the recent average load, as a fraction of the deadline.
+	 */
+	float get_average_load() const
+	{
+		return average_load.load(std::memory_order_relaxed);
+	}
+
+	float get_peak_load() const
+	{
+		return peak_load.load(std::memory_order_relaxed);
+	}
+
+	float get_deadline_us() const
+	{
+		return deadline_us.load(std::memory_order_relaxed);
+	}
+
+	uint64_t get_chunks() const
+	{
+		return chunks.load(std::memory_order_relaxed);
+	}
+
+	// Callbacks that took longer than the deadline.
+	uint64_t get_overruns() const
+	{
+		return overruns.load(std::memory_order_relaxed);
+	}
+
+	// Callbacks that started more than two device periods after the previous one, meaning one was probably missed.
+	uint64_t get_late_callbacks() const
+	{
+		return late_callbacks.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Write the statistics to a text file.
+	 */
+	void dump(const std::filesystem::path &filename) const;
+
+private:
+	// Only written by start(), before the audio thread starts calling record().
+	double ticks_per_second{};
+
+	// Written by start(), and updated by set_sample_rate() and set_period_size().
+	std::atomic<float> load_per_tick{};
+	std::atomic<float> deadline_us{};
+	std::atomic<float> late_load{2};
+
+	// Only written by the audio thread.
+	std::array<std::atomic<uint64_t>, bins> histogram{};
+	std::atomic<uint64_t> chunks{};
+	std::atomic<uint64_t> overruns{};
+	std::atomic<uint64_t> late_callbacks{};
+	std::atomic<float> average_load{};
+	std::atomic<float> peak_load{};
+	uint64_t last_begin{};
+
+	// With a single writer, a relaxed load and store is enough, and avoids a locked instruction.
+	template<typename T>
+	static void increment(std::atomic<T> &counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+};
+
+extern RenderMonitor render_monitor;
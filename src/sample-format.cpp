@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "sample-format.hpp"
+
+#include <cstring>
+
+#include "simd.hpp"
+
+const char *get_name(SampleFormat format)
+{
+	switch (format) {
+	case SampleFormat::S16:
+		return "S16";
+	case SampleFormat::S24_3LE:
+		return "S24_3LE";
+	case SampleFormat::S32:
+		return "S32";
+	case SampleFormat::F32:
+		return "F32";
+	}
+
+	return "unknown";
+}
+
+template<SampleFormat format>
+PLING_SIMD_INLINE void write_sample(uint8_t *out, float value, int32_t integer)
+{
+	if constexpr (format == SampleFormat::F32) {
+		memcpy(out, &value, sizeof value);
+	} else if constexpr (format == SampleFormat::S32) {
+		memcpy(out, &integer, sizeof integer);
+	} else if constexpr (format == SampleFormat::S16) {
+		int16_t sample = integer;
+		memcpy(out, &sample, sizeof sample);
+	} else {
+		out[0] = integer;
+		out[1] = integer >> 8;
+		out[2] = integer >> 16;
+	}
+}
+
+template<SampleFormat format>
+PLING_SIMD_INLINE void convert(const float *samples, float gain, unsigned int channels, uint8_t *out)
+{
+	using SIMD::vfloat;
+	using SIMD::vint;
+
+	constexpr size_t sample_size = get_sample_size(format);
+	const unsigned int used_channels = channels < 2 ? channels : 2;
+	const size_t padding = (channels - used_channels) * sample_size;
+
+	// For S32, use the largest float below 2^31, since 2^31 itself does not fit in an int32_t.
+	const float full_scale = format == SampleFormat::S32 ? 2147483520.0f : format == SampleFormat::S24_3LE ? 8388607.0f : 32767.0f;
+
+	for (size_t i = 0; i < chunk_size; i += SIMD::lanes) {
+		vfloat x = SIMD::clamp(SIMD::load(samples + i) * gain, -1.0f, 1.0f);
+		vint integer{};
+
+		if constexpr (format != SampleFormat::F32) {
+			integer = __builtin_convertvector(x * full_scale, vint);
+		}
+
+		for (size_t j = 0; j < SIMD::lanes; ++j) {
+			if (used_channels == 2) {
+				write_sample<format>(out, x[j], integer[j]);
+				write_sample<format>(out + sample_size, x[j], integer[j]);
+				out += 2 * sample_size;
+			} else {
+				write_sample<format>(out, x[j], integer[j]);
+				out += sample_size;
+			}
+
+			if (padding) {
+				memset(out, 0, padding);
+				out += padding;
+			}
+		}
+	}
+}
+
+PLING_TARGET_CLONES void convert_chunk(const Chunk &chunk, float gain, SampleFormat format, unsigned int channels, void *output)
+{
+	static_assert(chunk_size % SIMD::lanes == 0);
+
+	auto out = static_cast<uint8_t *>(output);
+
+	switch (format) {
+	case SampleFormat::S16:
+		convert<SampleFormat::S16>(chunk.samples.data(), gain, channels, out);
+		break;
+	case SampleFormat::S24_3LE:
+		convert<SampleFormat::S24_3LE>(chunk.samples.data(), gain, channels, out);
+		break;
+	case SampleFormat::S32:
+		convert<SampleFormat::S32>(chunk.samples.data(), gain, channels, out);
+		break;
+	case SampleFormat::F32:
+		convert<SampleFormat::F32>(chunk.samples.data(), gain, channels, out);
+		break;
+	}
+}
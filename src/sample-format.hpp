@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pling.hpp"
+
+/**
+ * Sample formats an audio device can be fed with, all in native byte order except where noted.
+ */
+enum class SampleFormat {
+	S16,
+	S24_3LE, // 24-bit signed little-endian, packed in 3 bytes
+	S32,
+	F32,
+};
+
+constexpr size_t get_sample_size(SampleFormat format)
+{
+	switch (format) {
+	case SampleFormat::S16:
+		return 2;
+	case SampleFormat::S24_3LE:
+		return 3;
+	case SampleFormat::S32:
+	case SampleFormat::F32:
+		return 4;
+	}
+
+	return 0;
+}
+
+const char *get_name(SampleFormat format);
+
+/**
+ * Convert a mono chunk to interleaved frames for an audio device.
+ *
+ * Each sample is multiplied by gain and clipped to -1..1 once,
+ * then written to the first two channels. Any further channels are silenced.
+ *
+ * @param output  Must have room for chunk_size frames of the given format and number of channels.
+ */
+void convert_chunk(const Chunk &chunk, float gain, SampleFormat format, unsigned int channels, void *output);
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+/**
+ * Portable SIMD vectors using compiler vector extensions.
+ *
+ * These compile to SSE or AVX on x86 and to NEON on ARM.
+ * Functions that should use the widest vector unit of the CPU they run on
+ * can be marked with PLING_TARGET_CLONES, which lets the dynamic linker pick
+ * the best version at startup, based on the CPU features that are present.
+ */
+
+#ifndef PLING_TARGET_CLONES
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+#define PLING_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define PLING_TARGET_CLONES
+#endif
+#endif
+
+/* Vectors are passed in different registers depending on the target,
+ * so the helper functions below must always be inlined into their callers,
+ * otherwise a cloned function would call them with the wrong calling convention. */
+#define PLING_SIMD_INLINE static inline __attribute__((always_inline))
+
+namespace SIMD
+{
+
+static const size_t lanes = 8;
+
+typedef float vfloat __attribute__((vector_size(lanes * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(lanes * sizeof(int32_t))));
+
+PLING_SIMD_INLINE vfloat broadcast(float value)
+{
+	return vfloat{} + value;
+}
+
+// Load and store vectors from memory that might not be aligned
+PLING_SIMD_INLINE vfloat load(const float *data)
+{
+	vfloat x;
+	__builtin_memcpy(&x, data, sizeof x);
+	return x;
+}
+
+PLING_SIMD_INLINE void store(float *data, vfloat x)
+{
+	__builtin_memcpy(data, &x, sizeof x);
+}
+
+PLING_SIMD_INLINE float sum(vfloat x)
+{
+	float result{};
+
+	for (size_t i = 0; i < lanes; ++i) {
+		result += x[i];
+	}
+
+	return result;
+}
+
+PLING_SIMD_INLINE vfloat select(vint mask, vfloat a, vfloat b)
+{
+	return mask ? a : b;
+}
+
+PLING_SIMD_INLINE vfloat floor(vfloat x)
+{
+	vfloat t = __builtin_convertvector(__builtin_convertvector(x, vint), vfloat);
+	return select(t > x, t - 1.0f, t);
+}
+
+PLING_SIMD_INLINE vfloat abs(vfloat x)
+{
+	return select(x < 0.0f, -x, x);
+}
+
+PLING_SIMD_INLINE vfloat clamp(vfloat x, float low, float high)
+{
+	x = select(x < low, broadcast(low), x);
+	return select(x > high, broadcast(high), x);
+}
+
+PLING_SIMD_INLINE vfloat frac(vfloat x)
+{
+	return x - floor(x);
+}
+
+/**
+ * Calculate sin(2 * pi * x).
+ *
+ * This uses the same minimax polynomial on a quarter period as Oscillator::PM::sine_polynomial(),
+ * with a maximum error of about 6e-7.
+ */
+PLING_SIMD_INLINE vfloat sine_turns(vfloat x)
+{
+	// Reduce to -0.5..0.5 turns, then fold into -0.25..0.25 turns.
+	vfloat r = x - floor(x + 0.5f);
+	r = select(r > 0.25f, 0.5f - r, r);
+	r = select(r < -0.25f, -0.5f - r, r);
+
+	vfloat r2 = r * r;
+	vfloat p = broadcast(-70.9934333f);
+	p = p * r2 + 81.3407689f;
+	p = p * r2 - 41.3371424f;
+	p = p * r2 + 6.28316404f;
+	return p * r;
+}
+
+/**
+ * Calculate 2^x, with a maximum relative error of about 1e-7.
+ */
+PLING_SIMD_INLINE vfloat exp2(vfloat x)
+{
+	x = clamp(x, -126.0f, 126.0f);
+	vfloat i = floor(x + 0.5f);
+	vfloat f = (x - i) * float(M_LN2);
+	vfloat p = broadcast(1.0f / 5040.0f);
+	p = p * f + 1.0f / 720.0f;
+	p = p * f + 1.0f / 120.0f;
+	p = p * f + 1.0f / 24.0f;
+	p = p * f + 1.0f / 6.0f;
+	p = p * f + 0.5f;
+	p = p * f + 1.0f;
+	p = p * f + 1.0f;
+
+	// Multiply by 2^i by adding i to the exponent.
+	vint bits = (vint)p + (__builtin_convertvector(i, vint) << 23);
+	return (vfloat)bits;
+}
+
+PLING_SIMD_INLINE vfloat dB_to_amplitude(vfloat value)
+{
+	return exp2(value * float(M_LN10 / M_LN2 / 20.0));
+}
+
+}
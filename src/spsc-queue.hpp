@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * A lock-free queue with a fixed capacity, for one producer and one consumer thread.
+ *
+ * The producer may only call push(), the consumer only front() and pop().
+ * Neither of them ever blocks or allocates memory.
+ */
+template<typename T, size_t N>
+class SPSCQueue
+{
+	static_assert(N && (N & (N - 1)) == 0, "The capacity must be a power of two");
+
+	std::array<T, N> items{};
+
+	// Keep the indices in separate cache lines, since they are written by different threads.
+	alignas(64) std::atomic<size_t> head{};
+	alignas(64) std::atomic<size_t> tail{};
+
+public:
+	/**
+	 * Add an item to the end of the queue.
+	 *
+	 * @return False if the queue was full, in which case the item is not added.
+	 */
+	bool push(const T &item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if (t - head.load(std::memory_order_acquire) == N) {
+			return false;
+		}
+
+		items[t % N] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Check whether the queue is full. Only the producer may call this.
+	 */
+	bool full() const
+	{
+		return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire) == N;
+	}
+
+	/**
+	 * Get the item at the front of the queue, without removing it.
+	 *
+	 * @return A pointer to the item, or nullptr if the queue is empty.
+	 */
+	const T *front() const
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h == tail.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+
+		return &items[h % N];
+	}
+
+	/**
+	 * Remove the item at the front of the queue. The queue must not be empty.
+	 */
+	void pop()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
@@ -6,8 +6,9 @@
 void State::set_pot(MIDI::Control control, MIDI::Port &port, int8_t value)
 {
 	if (mode == Mode::INSTRUMENT) {
-		auto program = programs.get_last_activated_program();
-		program->set_pot(control, value);
+		if (auto program = programs.get_last_activated_program()) {
+			program->set_pot(control, value);
+		}
 	}
 }
 
@@ -19,16 +20,18 @@ void State::set_fader(MIDI::Control control, MIDI::Port &port, int8_t value)
 	}
 
 	if (mode == Mode::INSTRUMENT) {
-		auto program = programs.get_last_activated_program();
-		program->set_fader(control, value);
+		if (auto program = programs.get_last_activated_program()) {
+			program->set_fader(control, value);
+		}
 	}
 }
 
 void State::set_button(MIDI::Control control, MIDI::Port &port, int8_t value)
 {
 	if (mode == Mode::INSTRUMENT) {
-		auto program = programs.get_last_activated_program();
-		program->set_button(control, value);
+		if (auto program = programs.get_last_activated_program()) {
+			program->set_button(control, value);
+		}
 	}
 }
 
@@ -3,6 +3,8 @@
 
 #include "ui.hpp"
 
+#include <algorithm>
+#include <cfloat>
 #include <fmt/format.h>
 #include <glm/glm.hpp>
 #include <SDL2/SDL.h>
@@ -14,7 +16,9 @@
 #include "imgui/backends/imgui_impl_opengl3.h"
 #include "imgui/backends/imgui_impl_sdl.h"
 #include "imgui/imgui.h"
+#include "render-monitor.hpp"
 #include "state.hpp"
+#include "voice-governor.hpp"
 
 UI::Window::Window(float w, float h)
 {
@@ -142,9 +146,55 @@ void UI::build_status_bar()
 	ImGui::SetNextWindowPos({16.0f, 0.0f});
 	ImGui::BeginChild("status", {w - 32.0f, 16.0f}, false);
 	ImGui::Text("Pling!");
+
+	if (auto latency = programs.get_load_latency()) {
+		ImGui::SameLine();
+		ImGui::Text("  Program load: %.1f ms", latency);
+	}
+
+	build_load_meter();
 	ImGui::EndChild();
 }
 
+void UI::build_load_meter()
+{
+	// Right-aligned, next to the right volume meter
+	const float width = 128.0f;
+	ImGui::SameLine(w - 32.0f - width);
+
+	float load = render_monitor.get_average_load();
+	auto overruns = render_monitor.get_overruns();
+	auto label = fmt::format("DSP {:.0f}%", load * 100);
+
+	ImGui::PushStyleColor(ImGuiCol_PlotHistogram, load > 0.8f || overruns ? ImVec4{0.75f, 0, 0, 1} : ImVec4{0, 0.5f, 0, 1});
+	ImGui::ProgressBar(std::min(load, 1.0f), {width, 16.0f}, label.c_str());
+	ImGui::PopStyleColor();
+
+	if (!ImGui::IsItemHovered()) {
+		return;
+	}
+
+	auto counts = render_monitor.get_histogram();
+	float histogram[RenderMonitor::bins];
+	std::copy(counts.begin(), counts.end(), histogram);
+
+	ImGui::BeginTooltip();
+	ImGui::Text("Render time per chunk, deadline %.0f µs", render_monitor.get_deadline_us());
+	ImGui::PlotHistogram("", histogram, RenderMonitor::bins, 0, "0% - 200%", 0, FLT_MAX, {256.0f, 64.0f});
+	ImGui::Text("p50 %.0f%%, p99 %.0f%%, max %.0f%%", render_monitor.get_percentile(0.5f) * 100, render_monitor.get_percentile(0.99f) * 100, render_monitor.get_peak_load() * 100);
+	ImGui::Text("Overruns: %llu, late callbacks: %llu", (unsigned long long)overruns, (unsigned long long)render_monitor.get_late_callbacks());
+
+	if (auto program = programs.get_last_activated_program()) {
+		ImGui::Text("%s: average %.1f%%, max %.1f%%", program->get_name().c_str(), program->get_render_load() * 100, program->get_peak_render_load() * 100);
+	}
+
+	if (auto limit = voice_governor.get_limit(); limit < VoiceGovernor::unlimited) {
+		ImGui::Text("Voice limit: %u", (unsigned int)limit);
+	}
+
+	ImGui::EndTooltip();
+}
+
 void UI::build_volume_meter(const char *name)
 {
 	float dB = amplitude_to_dB(ringbuffer.get_rms() * state.get_master_volume());
@@ -243,8 +293,9 @@ void UI::build_program_select()
 		return;
 	}
 
-	auto &program = active_port->get_channel(active_channel).program;
-	const auto current_MIDI_program = program->get_MIDI_program();
+	// Channels that have not been used yet have no program.
+	auto program = active_port->get_channel(active_channel).get_program();
+	const int current_MIDI_program = program ? program->get_MIDI_program() : -1;
 
 	ImGui::PushFont(big_font);
 	ImGui::BeginTable("program-select", 2);
@@ -308,17 +359,18 @@ void UI::build_main_program()
 		show_program_select = true;
 	}
 
-	const auto &program = port->get_channel(channel).program;
+	auto program = port->get_channel(channel).get_program();
+	auto label = program ? fmt::format("{:03d}: {}", program->get_MIDI_program() + 1, program->get_name()) : std::string("---: Not used yet");
 
 	ImGui::PushFont(big_font);
 
-	if (ImGui::Selectable(fmt::format("{:03d}: {}", program->get_MIDI_program() + 1, program->get_name()).c_str()) || ImGui::IsKeyPressed(SDL_SCANCODE_P)) {
+	if (ImGui::Selectable(label.c_str()) || ImGui::IsKeyPressed(SDL_SCANCODE_P)) {
 		show_program_select = true;
 	}
 
 	ImGui::PopFont();
 
-	ImGui::Text("Synth engine: %s", program->get_engine_name().c_str());
+	ImGui::Text("Synth engine: %s", program ? program->get_engine_name().c_str() : "None");
 	ImGui::Separator();
 	ImGui::Selectable(fmt::format("Track: 01  Pattern: 01  Metre: 4/4  Tempo: {:3.0f}", master_clock.get_tempo()).c_str());
 	auto time = master_clock.get_time_position();
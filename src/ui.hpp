@@ -38,6 +38,7 @@ class UI
 	void process_window_event(const SDL_WindowEvent &ev);
 	bool process_events();
 	void build_status_bar();
+	void build_load_meter();
 	void build_volume_meter(const char *name);
 	void build_volume_meters();
 	void build_key_bar();
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "voice-governor.hpp"
+
+#include <algorithm>
+
+void VoiceGovernor::update(float load)
+{
+	auto voices = peak_voices.exchange(0, std::memory_order_relaxed);
+	auto current = limit.load(std::memory_order_relaxed);
+
+	if (cooldown) {
+		cooldown--;
+	}
+
+	if (load > high_load) {
+		calm = 0;
+
+		// Without any voices playing, the load is not caused by them, so leave the limit alone.
+		if (!cooldown && voices) {
+			// Shed at most a quarter of the voices that were actually playing.
+			auto playing = std::min(current, voices);
+			limit.store(std::max(min_voices, playing - playing / 4), std::memory_order_relaxed);
+			cooldown = cooldown_chunks;
+		}
+	} else if (load < low_load) {
+		if (++calm >= raise_chunks) {
+			calm = 0;
+
+			if (current < unlimited) {
+				limit.store(current + 1, std::memory_order_relaxed);
+			}
+		}
+	} else {
+		calm = 0;
+	}
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Adapts the maximum number of voices per program to the measured render load.
+ *
+ * When a chunk takes too long to render, the voice limit is lowered below the number of voices
+ * that was playing, and VoiceManagers shed their quietest voices to get below it.
+ * When there is enough headroom for a while, the limit is raised again one voice at a time.
+ * This turns xruns into graceful degradation on slow machines.
+ */
+class VoiceGovernor
+{
+public:
+	// The most voices any program can have, see VoiceManager::max_voices.
+	static constexpr uint32_t unlimited = 1024;
+	static constexpr uint32_t min_voices = 4;
+
+	/**
+	 * Get the current maximum number of voices a program may play.
+	 */
+	uint32_t get_limit() const
+	{
+		return limit.load(std::memory_order_relaxed);
+	}
+
+	/**
+	 * Report the number of voices a program is playing. Can be called from any render thread.
+	 */
+	void report(uint32_t voices)
+	{
+		auto peak = peak_voices.load(std::memory_order_relaxed);
+
+		while (voices > peak && !peak_voices.compare_exchange_weak(peak, voices, std::memory_order_relaxed)) {
+		}
+	}
+
+	/**
+	 * Update the limit after a chunk has been rendered. Only the audio thread may call this.
+	 *
+	 * @param load  The time it took to render the chunk, as a fraction of the deadline.
+	 */
+	void update(float load);
+
+private:
+	// Lower the limit when a chunk used more than this fraction of the deadline.
+	static constexpr float high_load = 0.9f;
+
+	// Raise the limit when chunks used less than this fraction of the deadline for a while.
+	static constexpr float low_load = 0.6f;
+
+	// Wait this many chunks after lowering the limit before lowering it again, so the shedding can take effect.
+	static const unsigned int cooldown_chunks = 16;
+
+	// The number of consecutive chunks with a low load needed to raise the limit by one voice.
+	static const unsigned int raise_chunks = 128;
+
+	std::atomic<uint32_t> limit{unlimited};
+	std::atomic<uint32_t> peak_voices{};
+
+	// Only used by the audio thread.
+	unsigned int cooldown{};
+	unsigned int calm{};
+};
+
+extern VoiceGovernor voice_governor;
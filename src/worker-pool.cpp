@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include "worker-pool.hpp"
+
+#include <fmt/ostream.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+
+static thread_local bool is_worker;
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+}
+
+void WorkerPool::start(size_t nthreads)
+{
+	stop();
+
+	for (size_t i = 1; i < nthreads; ++i) {
+		auto &thread = threads.emplace_back(&WorkerPool::work, this);
+
+		// Try to get real-time priority, but continue without it if we are not allowed to.
+		sched_param param{};
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+
+		if (pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) != 0 && i == 1) {
+			fmt::print(std::cerr, "Could not get real-time priority for render threads\n");
+		}
+	}
+}
+
+void WorkerPool::stop()
+{
+	{
+		std::lock_guard lock(mutex);
+		quit = true;
+	}
+
+	start_cond.notify_all();
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	threads.clear();
+	quit = false;
+}
+
+void WorkerPool::work()
+{
+	is_worker = true;
+	uint64_t seen_generation{};
+	std::unique_lock lock(mutex);
+
+	while (true) {
+		start_cond.wait(lock, [&] {
+			return quit || generation != seen_generation;
+		});
+
+		if (quit) {
+			break;
+		}
+
+		seen_generation = generation;
+		auto batch_count = count;
+		auto &batch_task = *task;
+		lock.unlock();
+		execute(seen_generation, batch_count, batch_task);
+		lock.lock();
+	}
+}
+
+void WorkerPool::execute(uint64_t generation, size_t count, const std::function<void(size_t)> &task)
+{
+	const uint64_t tag = (generation << 32) & ~index_mask;
+	size_t done{};
+	uint64_t current = next.load();
+
+	while ((current & ~index_mask) == tag && (current & index_mask) < count) {
+		if (next.compare_exchange_weak(current, current + 1)) {
+			task(current & index_mask);
+			++done;
+			current = next.load();
+		}
+	}
+
+	// The thread finishing the last task wakes up the caller of run().
+	if (done && pending.fetch_sub(done) == done) {
+		std::lock_guard lock(mutex);
+		done_cond.notify_one();
+	}
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &task)
+{
+	if (threads.empty() || count < 2 || is_worker || running) {
+		for (size_t i = 0; i < count; ++i) {
+			task(i);
+		}
+
+		return;
+	}
+
+	running = true;
+	uint64_t batch_generation;
+
+	{
+		std::lock_guard lock(mutex);
+		this->task = &task;
+		this->count = count;
+		batch_generation = ++generation;
+		pending = count;
+		next = (batch_generation << 32) & ~index_mask;
+	}
+
+	start_cond.notify_all();
+	execute(batch_generation, count, task);
+
+	{
+		std::unique_lock lock(mutex);
+		done_cond.wait(lock, [&] {
+			return pending == 0;
+		});
+	}
+
+	running = false;
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed pool of real-time worker threads.
+ *
+ * The thread calling run() wakes up all workers, helps executing the tasks
+ * itself, and then waits until all tasks have finished.
+ * Only one thread (normally the audio thread) may call run() at a time.
+ * Calls to run() from within a task are executed serially by the calling thread.
+ */
+class WorkerPool
+{
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable start_cond;
+	std::condition_variable done_cond;
+	uint64_t generation{};
+	bool quit{};
+	bool running{};
+
+	// The current batch, only changed while holding the mutex.
+	const std::function<void(size_t)> *task{};
+	size_t count{};
+
+	// The next task index in the low 32 bits, tagged with the generation of its batch in the high 32 bits,
+	// so a worker that was preempted while a new batch started cannot take an index from it.
+	static constexpr uint64_t index_mask = 0xffffffff;
+	std::atomic<uint64_t> next{};
+	std::atomic<size_t> pending{};
+
+	void work();
+	void execute(uint64_t generation, size_t count, const std::function<void(size_t)> &task);
+
+public:
+	WorkerPool() = default;
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool &other) = delete;
+	WorkerPool(WorkerPool &&other) = delete;
+	WorkerPool &operator=(const WorkerPool &other) = delete;
+
+	/**
+	 * Start the worker threads.
+	 *
+	 * @param nthreads  The total number of threads that should render audio,
+	 *                  including the thread calling run().
+	 *                  If this is 1 or less, no worker threads are started.
+	 */
+	void start(size_t nthreads);
+	void stop();
+
+	/**
+	 * Execute a batch of tasks, and wait for all of them to finish.
+	 *
+	 * @param count  The number of tasks.
+	 * @param task   The function to call for each task, with the task index as its argument.
+	 */
+	void run(size_t count, const std::function<void(size_t)> &task);
+
+	/**
+	 * Get the number of threads that will execute tasks, including the calling thread.
+	 */
+	size_t size() const
+	{
+		return threads.size() + 1;
+	}
+};
+
+extern WorkerPool worker_pool;